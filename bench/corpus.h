@@ -0,0 +1,258 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// ======================
+// Synthetic Corpus
+// ======================
+// Machine-made documents for the benchmarks, in any of the formats emlc reads
+// or writes. The shape is set by a CorpusSpec: every element has `fanout`
+// children down to `depth` levels, then leaves - short text, or a raw block
+// for a `raw_ratio` share of them. Top-level trees are added until the
+// document reaches `bytes`. The same spec and seed always give the same text.
+
+enum CorpusFormat { CORPUS_EML, CORPUS_HTML, CORPUS_XAML, CORPUS_FXML };
+
+inline const char* const CORPUS_FORMAT_NAMES[] = {"eml", "html", "xaml", "fxml"};
+
+struct CorpusSpec {
+    CorpusFormat format = CORPUS_EML;
+    size_t bytes = size_t(4) << 20; // stop adding trees past this size
+    int depth = 6;                  // element levels below each top-level element
+    int fanout = 4;                 // children per element
+    double attrs = 2.0;             // mean attributes per element
+    double raw_ratio = 0.05;        // leaves that are raw blocks (script/style/php; comments in XAML/FXML)
+    uint32_t seed = 1;
+};
+
+class CorpusWriter {
+public:
+    explicit CorpusWriter(const CorpusSpec& spec) : spec(spec), rng(spec.seed) {}
+
+    string make() {
+        out.clear();
+        out.reserve(spec.bytes + (size_t(1) << 16));
+        prologue();
+        while (out.size() < spec.bytes) tree();
+        epilogue();
+        return std::move(out);
+    }
+
+private:
+    CorpusSpec spec;
+    mt19937 rng;
+    string out;
+
+    struct Open {
+        string_view tag;
+        int children_left;
+    };
+
+    static constexpr const char* HTML_BLOCKS[] = {"div", "section", "article", "ul", "nav", "form", "table"};
+    static constexpr const char* HTML_LEAVES[] = {"p", "span", "a", "li", "h2", "label", "button", "td"};
+    static constexpr const char* HTML_ATTRS[] = {"class", "id", "href", "title", "data-id", "aria-label", "style"};
+    static constexpr const char* XAML_BLOCKS[] = {"Grid", "StackPanel", "Border", "DockPanel", "ScrollViewer", "WrapPanel"};
+    static constexpr const char* XAML_LEAVES[] = {"TextBlock", "Button", "TextBox", "CheckBox", "Image", "Label"};
+    static constexpr const char* XAML_ATTRS[] = {"Margin", "Width", "Height", "Text", "Visibility", "Grid.Row", "Foreground"};
+    static constexpr const char* FXML_BLOCKS[] = {"VBox", "HBox", "BorderPane", "AnchorPane", "GridPane", "StackPane"};
+    static constexpr const char* FXML_LEAVES[] = {"Label", "Button", "TextField", "CheckBox", "ImageView", "Separator"};
+    static constexpr const char* FXML_ATTRS[] = {"fx:id", "text", "spacing", "alignment", "prefWidth", "styleClass", "onAction"};
+    static constexpr const char* WORDS[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+                                            "sed", "do", "eiusmod", "tempor", "incididunt", "labore", "magna", "aliqua"};
+
+    template <size_t N>
+    string_view pick(const char* const (&list)[N]) {
+        return list[rng() % N];
+    }
+
+    bool chance(double p) {
+        return uniform_real_distribution<double>(0.0, 1.0)(rng) < p;
+    }
+
+    bool is_eml() const { return spec.format == CORPUS_EML; }
+    bool is_html() const { return spec.format == CORPUS_HTML || spec.format == CORPUS_EML; }
+
+    string_view block_tag() {
+        if (is_html()) return pick(HTML_BLOCKS);
+        return spec.format == CORPUS_XAML ? pick(XAML_BLOCKS) : pick(FXML_BLOCKS);
+    }
+
+    string_view leaf_tag() {
+        if (is_html()) return pick(HTML_LEAVES);
+        return spec.format == CORPUS_XAML ? pick(XAML_LEAVES) : pick(FXML_LEAVES);
+    }
+
+    string_view attr_name() {
+        if (is_html()) return pick(HTML_ATTRS);
+        return spec.format == CORPUS_XAML ? pick(XAML_ATTRS) : pick(FXML_ATTRS);
+    }
+
+    void words(int n) {
+        for (int i = 0; i < n; ++i) {
+            if (i) out += ' ';
+            out += pick(WORDS);
+        }
+    }
+
+    void indent(size_t level) {
+        out.append(level * 4, ' ');
+    }
+
+    // Attribute count: `attrs` on average, a fraction rounding up or down at random
+    void attributes() {
+        int n = int(spec.attrs);
+        if (chance(spec.attrs - n)) ++n;
+        for (int i = 0; i < n; ++i) {
+            string_view key = attr_name();
+            if (is_eml()) out += i ? ", " : " (";
+            else out += ' ';
+            out += key;
+            out += is_eml() ? " = \"" : "=\"";
+            if (chance(0.2)) words(3 + int(rng() % 6)); // a long value now and then
+            else {
+                out += pick(WORDS);
+                out += to_string(rng() % 1000);
+            }
+            out += '"';
+        }
+        if (is_eml() && n > 0) out += ')';
+    }
+
+    void open_tag(string_view tag, size_t level) {
+        indent(level);
+        if (is_eml()) {
+            out += tag;
+            attributes();
+            out += " {\n";
+        } else {
+            out += '<';
+            out += tag;
+            attributes();
+            out += ">\n";
+        }
+    }
+
+    void close_tag(string_view tag, size_t level) {
+        indent(level);
+        if (is_eml()) {
+            out += "}\n";
+        } else {
+            out += "</";
+            out += tag;
+            out += ">\n";
+        }
+    }
+
+    void leaf(size_t level) {
+        indent(level);
+        if (chance(spec.raw_ratio)) {
+            raw_block(level);
+            return;
+        }
+        string_view tag = leaf_tag();
+        if (is_eml()) {
+            out += tag;
+            attributes();
+            out += " { ";
+            words(2 + int(rng() % 8));
+            out += " }\n";
+        } else {
+            out += '<';
+            out += tag;
+            attributes();
+            out += '>';
+            words(2 + int(rng() % 8));
+            out += "</";
+            out += tag;
+            out += ">\n";
+        }
+    }
+
+    // Code with braces and markup-looking text that must be kept verbatim
+    void raw_block(size_t level) {
+        static constexpr const char* CODE[] = {
+            "function update(el) { if (el.value < 10) { el.hidden = true; } }",
+            "const rows = data.map(r => `<li>${r.name}</li>`).join('');",
+            ".card > .title { font-weight: bold; margin: 0 0 4px 0; }",
+            "for ($i = 0; $i < count($items); $i++) { echo $items[$i]; }",
+        };
+        int lines = 2 + int(rng() % 6);
+        if (!is_html()) {
+            out += "<!-- ";
+            words(6 * lines);
+            out += " -->\n";
+            return;
+        }
+        int kind = int(rng() % 3);
+        const char* tag = kind == 0 ? "script" : kind == 1 ? "style" : "php";
+        if (is_eml()) {
+            out += tag;
+            out += " {\n";
+        } else {
+            out += kind == 2 ? "<?php\n" : string("<") + tag + ">\n";
+        }
+        for (int i = 0; i < lines; ++i) {
+            indent(level + 1);
+            out += pick(CODE);
+            out += '\n';
+        }
+        indent(level);
+        if (is_eml()) out += "}\n";
+        else out += kind == 2 ? "?>\n" : string("</") + tag + ">\n";
+    }
+
+    void prologue() {
+        if (spec.format == CORPUS_XAML) {
+            out += "<Grid xmlns=\"http://schemas.microsoft.com/winfx/2006/xaml/presentation\" "
+                   "xmlns:x=\"http://schemas.microsoft.com/winfx/2006/xaml\">\n";
+        }
+        if (spec.format == CORPUS_FXML) {
+            out += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+            out += "<?import javafx.scene.control.*?>\n";
+            out += "<?import javafx.scene.layout.*?>\n";
+            out += "<VBox xmlns:fx=\"http://javafx.com/fxml\">\n";
+        }
+    }
+
+    void epilogue() {
+        if (spec.format == CORPUS_XAML) out += "</Grid>\n";
+        if (spec.format == CORPUS_FXML) out += "</VBox>\n";
+    }
+
+    // One top-level element and its subtree, cut short once the document is
+    // big enough
+    void tree() {
+        size_t base = is_html() ? 0 : 1; // XAML/FXML trees sit inside the root element
+        vector<Open> open;
+        string_view top = block_tag();
+        open_tag(top, base);
+        open.push_back({top, spec.depth > 0 ? spec.fanout : 0});
+        while (!open.empty()) {
+            Open& o = open.back();
+            size_t level = base + open.size();
+            if (o.children_left == 0 || out.size() >= spec.bytes) {
+                close_tag(o.tag, level - 1);
+                open.pop_back();
+                continue;
+            }
+            --o.children_left;
+            if (int(open.size()) < spec.depth) {
+                string_view tag = block_tag();
+                open_tag(tag, level);
+                open.push_back({tag, spec.fanout});
+            } else {
+                leaf(level);
+            }
+        }
+    }
+};
+
+inline string make_corpus(const CorpusSpec& spec) {
+    return CorpusWriter(spec).make();
+}
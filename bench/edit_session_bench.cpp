@@ -0,0 +1,94 @@
+// Per-keystroke latency of EditSession vs. a full reparse
+//
+// Builds a 10k-line document (sections of blocks holding short text lines),
+// then types and deletes characters in the text of random paragraphs, one
+// edit at a time, timing each edit. The full-parse column is what reconverting the whole
+// buffer on every keystroke costs.
+//
+//   g++ -O2 -std=c++20 -I../emlc edit_session_bench.cpp -o edit_session_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc edit_session_bench.cpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "eml.h"
+#include "session.h"
+
+using namespace std;
+
+string make_eml_document(int lines) {
+    string s;
+    int line = 0;
+    for (int section = 0; line < lines; ++section) {
+        s += "section (id=\"s" + to_string(section) + "\") {\n"; ++line;
+        for (int item = 0; item < 20 && line < lines; ++item) {
+            s += "    div (class=\"item\") {\n"; ++line;
+            s += "        p { Paragraph " + to_string(item) + " of section " + to_string(section) + " }\n"; ++line;
+            s += "        a (href=\"/s" + to_string(section) + "/" + to_string(item) + "\") { link }\n"; ++line;
+            s += "    }\n"; ++line;
+        }
+        s += "}\n"; ++line;
+    }
+    return s;
+}
+
+string make_html_document(int lines) {
+    string s = "<html>\n<body>\n";
+    for (int line = 2, section = 0; line < lines; ++section) {
+        s += "<section id=\"s" + to_string(section) + "\">\n"; ++line;
+        for (int item = 0; item < 20 && line < lines; ++item) {
+            s += "  <div class=\"item\"><p>Paragraph " + to_string(item) + "</p><a href=\"/x\">link</a></div>\n"; ++line;
+        }
+        s += "</section>\n"; ++line;
+    }
+    return s + "</body>\n</html>\n";
+}
+
+// Offset just after the word "Paragraph" somewhere in the text
+size_t pick_offset(string_view text, mt19937& rng) {
+    size_t from = uniform_int_distribution<size_t>(0, text.size() - 1)(rng);
+    size_t at = text.find("Paragraph", from);
+    if (at == string_view::npos) at = text.find("Paragraph");
+    return at + 9;
+}
+
+void run(const char* name, const string& doc, bool is_eml, int edits) {
+    mt19937 rng(42);
+    EditSession session(doc, is_eml);
+    vector<double> us;
+    for (int i = 0; i < edits; ++i) {
+        size_t at = pick_offset(session.text(), rng);
+        auto t0 = chrono::steady_clock::now();
+        if (i % 2 == 0) session.edit(at, 0, "x");
+        else session.edit(at, 1, "");
+        us.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+    }
+    sort(us.begin(), us.end());
+
+    double full = 1e300;
+    for (int r = 0; r < 5; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        Parser p;
+        Document parsed = p.parse(string(session.text()), is_eml);
+        full = min(full, chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+    }
+
+    printf("%-6s %10zu %10.1f %10.1f %10.1f %12.1f %8zu %8zu\n", name, doc.size(),
+           us[us.size() / 2], us[us.size() * 99 / 100], us.back(), full,
+           session.partial_reparses, session.full_reparses);
+}
+
+int main(int argc, char* argv[]) {
+    int lines = argc > 1 ? atoi(argv[1]) : 10000;
+    int edits = argc > 2 ? atoi(argv[2]) : 2000;
+
+    printf("%-6s %10s %10s %10s %10s %12s %8s %8s\n", "input", "bytes", "p50 us", "p99 us", "max us",
+           "full us", "partial", "full");
+    run("eml", make_eml_document(lines), true, edits);
+    run("html", make_html_document(lines), false, edits);
+    return 0;
+}
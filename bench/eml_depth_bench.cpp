@@ -0,0 +1,55 @@
+// EML parse time vs. nesting depth
+//
+// Builds documents with a fixed amount of content per level (indentation is
+// not deepened, so bytes grow linearly too) and nests them deeper and deeper.
+// If parsing is linear in depth, the ns/level column stays flat.
+//
+//   g++ -O2 -std=c++20 -I../emlc eml_depth_bench.cpp -o eml_depth_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc eml_depth_bench.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eml.h"
+
+using namespace std;
+
+string make_nested_eml(int depth, int siblings) {
+    string s;
+    for (int d = 0; d < depth; ++d) {
+        s += "div (class=\"level-" + to_string(d) + "\", id=\"n" + to_string(d) + "\") {\n";
+        for (int k = 0; k < siblings; ++k) {
+            s += "    span (data-k=\"" + to_string(k) + "\") { Some text " + to_string(k) + " }\n";
+        }
+    }
+    for (int d = depth - 1; d >= 0; --d) {
+        s += "}\n";
+    }
+    return s;
+}
+
+double time_parse_ms(const string& doc, int reps) {
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        Parser p;
+        Document parsed = p.parse(doc, true);
+        auto t1 = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int max_depth = argc > 1 ? atoi(argv[1]) : 3840;
+    int siblings = argc > 2 ? atoi(argv[2]) : 1;
+
+    printf("%8s %12s %12s %12s\n", "depth", "bytes", "ms", "ns/level");
+    for (int depth = 15; depth <= max_depth; depth *= 2) {
+        string doc = make_nested_eml(depth, siblings);
+        double ms = time_parse_ms(doc, 5);
+        printf("%8d %12zu %12.3f %12.1f\n", depth, doc.size(), ms, ms * 1e6 / depth);
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+// Parser and formatter throughput on synthetic corpora
+//
+// Generates one document per input format from a shared shape (see corpus.h),
+// times Parser::parse on each, then every formatter on each parsed tree. Rows
+// report MB/s - of the input for parsing, of the output for formatting - and
+// ns per node, best of --reps runs. --json prints the same results for keeping
+// as a baseline, and --baseline compares a run against such a file.
+//
+//   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release && cmake --build build
+//   build/emlc_bench --json > before.json
+//   build/emlc_bench --baseline before.json
+//
+//   g++ -O2 -std=c++20 -I../emlc emlc_bench.cpp -o emlc_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc emlc_bench.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "eml.h"
+#include "corpus.h"
+
+using namespace std;
+
+// Discards the output, keeping only its size
+class CountingSink : public BufferedSink {
+public:
+    CountingSink() : BufferedSink(size_t(1) << 16) {}
+
+protected:
+    void drain(const char*, size_t) override {}
+};
+
+struct Result {
+    string name;  // "<input>/parse" or "<input>/to-<output>"
+    size_t bytes; // input bytes parsed, or output bytes written
+    size_t nodes;
+    double ms;    // best run
+
+    double mb_per_s() const { return bytes / ms / 1e3; }
+    double ns_per_node() const { return ms * 1e6 / max<size_t>(nodes, 1); }
+};
+
+size_t count_nodes(Node* root) {
+    size_t n = 0;
+    vector<Node*> stack = {root};
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        n++;
+        stack.insert(stack.end(), node->children.begin(), node->children.end());
+    }
+    return n;
+}
+
+unsigned threads = 1; // --threads
+
+Document parse_corpus(const string& doc, CorpusFormat format, double* ms) {
+    string copy = doc; // the parser adopts its input; copying isn't part of the time
+    auto t0 = chrono::steady_clock::now();
+    Parser p;
+    p.html = format == CORPUS_HTML;
+    p.threads = threads;
+    Document parsed = p.parse(std::move(copy), format == CORPUS_EML);
+    if (ms) *ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+    return parsed;
+}
+
+vector<Result> run_format(const CorpusSpec& spec, int reps) {
+    string doc = make_corpus(spec);
+    string input = CORPUS_FORMAT_NAMES[spec.format];
+    vector<Result> results;
+
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        double ms;
+        parse_corpus(doc, spec.format, &ms);
+        best = min(best, ms);
+    }
+    Document parsed = parse_corpus(doc, spec.format, nullptr);
+    size_t nodes = count_nodes(parsed.root);
+    results.push_back({input + "/parse", doc.size(), nodes, best});
+
+    EmlFormatter eml;
+    MarkupFormatter html(false);
+    MarkupFormatter xml(true);
+    eml.threads = html.threads = xml.threads = threads;
+    pair<const char*, Formatter*> formatters[] = {{"eml", &eml}, {"html", &html}, {"xml", &xml}};
+    for (auto [output, f] : formatters) {
+        best = 1e300;
+        size_t bytes = 0;
+        for (int r = 0; r < reps; ++r) {
+            CountingSink out;
+            auto t0 = chrono::steady_clock::now();
+            f->format(parsed.root, out);
+            out.flush();
+            best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count());
+            bytes = out.bytes_written();
+        }
+        results.push_back({input + "/to-" + output, bytes, nodes, best});
+    }
+    return results;
+}
+
+// ns/node by result name from a file written by --json. Reads only what this
+// program writes: one result object per line.
+bool read_baseline(const string& path, map<string, double>& ns_per_node) {
+    ifstream in(path);
+    if (!in) return false;
+    string line;
+    while (getline(in, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t ns = line.find("\"ns_per_node\": ");
+        if (name == string::npos || ns == string::npos) continue;
+        name += 9;
+        ns_per_node[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + ns + 15);
+    }
+    return true;
+}
+
+void print_json(const CorpusSpec& spec, int reps, const vector<Result>& results) {
+    static const char* isa_names[] = {"scalar", "sse2", "avx2"};
+    printf("{\n");
+    printf("  \"spec\": {\"bytes\": %zu, \"depth\": %d, \"fanout\": %d, \"attrs\": %g, \"raw_ratio\": %g, "
+           "\"seed\": %u, \"reps\": %d, \"threads\": %u, \"scan\": \"%s\"},\n",
+           spec.bytes, spec.depth, spec.fanout, spec.attrs, spec.raw_ratio, spec.seed, reps, threads, isa_names[scan_isa]);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        printf("    {\"name\": \"%s\", \"bytes\": %zu, \"nodes\": %zu, \"ms\": %.3f, \"mb_per_s\": %.2f, \"ns_per_node\": %.2f}%s\n",
+               r.name.c_str(), r.bytes, r.nodes, r.ms, r.mb_per_s(), r.ns_per_node(), i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+void print_table(const vector<Result>& results, const map<string, double>& baseline) {
+    printf("%-14s %12s %10s %10s %10s %10s", "case", "bytes", "nodes", "ms", "MB/s", "ns/node");
+    if (!baseline.empty()) printf(" %10s", "vs base");
+    printf("\n");
+    for (const Result& r : results) {
+        printf("%-14s %12zu %10zu %10.2f %10.1f %10.2f", r.name.c_str(), r.bytes, r.nodes, r.ms, r.mb_per_s(), r.ns_per_node());
+        auto it = baseline.find(r.name);
+        if (it != baseline.end() && it->second > 0) printf(" %+9.1f%%", (r.ns_per_node() / it->second - 1) * 100);
+        else if (!baseline.empty()) printf(" %10s", "-");
+        printf("\n");
+    }
+}
+
+void print_usage() {
+    printf("Usage: emlc_bench [options]\n");
+    printf("  --size <MB>          Size of each generated document (default: 4)\n");
+    printf("  --depth <n>          Element levels below each top-level element (default: 6)\n");
+    printf("  --fanout <n>         Children per element (default: 4)\n");
+    printf("  --attrs <n>          Mean attributes per element (default: 2)\n");
+    printf("  --raw <ratio>        Share of leaves that are raw blocks (default: 0.05)\n");
+    printf("  --seed <n>           Generator seed (default: 1)\n");
+    printf("  --formats <list>     Inputs to run, comma-separated (default: eml,html,xaml,fxml)\n");
+    printf("  --reps <n>           Runs per case; the best is reported (default: 5)\n");
+    printf("  --threads <n>        Threads per document, for large inputs (default: 1)\n");
+    printf("  --json               Print results as JSON\n");
+    printf("  --baseline <file>    Compare ns/node against a --json result file\n");
+    printf("  --write-corpus <dir> Write the generated documents to <dir> and exit\n");
+}
+
+int main(int argc, char* argv[]) {
+    CorpusSpec spec;
+    string formats = "eml,html,xaml,fxml";
+    string baseline_path;
+    string corpus_dir;
+    int reps = 5;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--size" && has_value) spec.bytes = size_t(atof(argv[++i]) * (1 << 20));
+        else if (arg == "--depth" && has_value) spec.depth = max(0, atoi(argv[++i]));
+        else if (arg == "--fanout" && has_value) spec.fanout = max(1, atoi(argv[++i]));
+        else if (arg == "--attrs" && has_value) spec.attrs = max(0.0, atof(argv[++i]));
+        else if (arg == "--raw" && has_value) spec.raw_ratio = atof(argv[++i]);
+        else if (arg == "--seed" && has_value) spec.seed = uint32_t(strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--formats" && has_value) formats = argv[++i];
+        else if (arg == "--reps" && has_value) reps = max(1, atoi(argv[++i]));
+        else if (arg == "--threads" && has_value) threads = unsigned(max(1, atoi(argv[++i])));
+        else if (arg == "--json") json = true;
+        else if (arg == "--baseline" && has_value) baseline_path = argv[++i];
+        else if (arg == "--write-corpus" && has_value) corpus_dir = argv[++i];
+        else {
+            print_usage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+
+    vector<CorpusFormat> inputs;
+    stringstream list(formats);
+    for (string name; getline(list, name, ',');) {
+        auto it = find(begin(CORPUS_FORMAT_NAMES), end(CORPUS_FORMAT_NAMES), name);
+        if (it == end(CORPUS_FORMAT_NAMES)) {
+            fprintf(stderr, "Error: Unknown format '%s'\n", name.c_str());
+            return 1;
+        }
+        inputs.push_back(CorpusFormat(it - begin(CORPUS_FORMAT_NAMES)));
+    }
+
+    if (!corpus_dir.empty()) {
+        for (CorpusFormat format : inputs) {
+            spec.format = format;
+            string path = corpus_dir + "/corpus." + CORPUS_FORMAT_NAMES[format];
+            ofstream out(path, ios::binary);
+            string doc = make_corpus(spec);
+            if (!out.write(doc.data(), doc.size())) {
+                fprintf(stderr, "Error: Could not write %s\n", path.c_str());
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    map<string, double> baseline;
+    if (!baseline_path.empty() && !read_baseline(baseline_path, baseline)) {
+        fprintf(stderr, "Error: Could not read baseline %s\n", baseline_path.c_str());
+        return 1;
+    }
+
+    vector<Result> results;
+    for (CorpusFormat format : inputs) {
+        spec.format = format;
+        for (Result& r : run_format(spec, reps)) results.push_back(std::move(r));
+    }
+
+    if (json) print_json(spec, reps, results);
+    else print_table(results, baseline);
+    return 0;
+}
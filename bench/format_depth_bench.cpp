@@ -0,0 +1,74 @@
+// Formatter throughput on deeply nested input
+//
+// Parses nested EML documents of increasing depth once, then times formatting
+// them to EML and HTML into an in-memory sink. Output grows faster than the node
+// count (indentation deepens), so throughput is reported in output MB/s. With
+// single-pass sink output it stays in the same range as depth grows (dropping only
+// once the output outgrows the caches); when every level returned a string that
+// its parent appended, each byte was copied once per ancestor.
+//
+//   g++ -O2 -std=c++20 -I../emlc format_depth_bench.cpp -o format_depth_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc format_depth_bench.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eml.h"
+
+using namespace std;
+
+string make_nested_eml(int depth, int siblings) {
+    string s;
+    for (int d = 0; d < depth; ++d) {
+        s += "div (class=\"level-" + to_string(d) + "\") {\n";
+        for (int k = 0; k < siblings; ++k) {
+            s += "    span (data-k=\"" + to_string(k) + "\") { Some text " + to_string(k) + " }\n";
+        }
+    }
+    for (int d = depth - 1; d >= 0; --d) {
+        s += "}\n";
+    }
+    return s;
+}
+
+size_t count_nodes(Node* n) {
+    size_t c = 1;
+    for (auto ch : n->children) c += count_nodes(ch);
+    return c;
+}
+
+double time_format_ms(Formatter& f, Node* root, size_t& out_bytes) {
+    double best = 1e300;
+    for (int r = 0; r < 5; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        StringSink out;
+        f.format(root, out);
+        auto t1 = chrono::steady_clock::now();
+        out_bytes = out.size();
+        best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int max_depth = argc > 1 ? atoi(argv[1]) : 960;
+    int siblings = argc > 2 ? atoi(argv[2]) : 2;
+
+    EmlFormatter eml;
+    MarkupFormatter html(false);
+
+    printf("%8s %8s %12s %10s %10s %10s %10s\n", "depth", "nodes", "out bytes", "eml ms", "eml MB/s", "html ms", "html MB/s");
+    for (int depth = 30; depth <= max_depth; depth *= 2) {
+        Parser p;
+        Document doc = p.parse(make_nested_eml(depth, siblings), true);
+        size_t nodes = count_nodes(doc.root);
+
+        size_t eml_bytes = 0, html_bytes = 0;
+        double eml_ms = time_format_ms(eml, doc.root, eml_bytes);
+        double html_ms = time_format_ms(html, doc.root, html_bytes);
+        printf("%8d %8zu %12zu %10.3f %10.1f %10.3f %10.1f\n", depth, nodes, eml_bytes,
+            eml_ms, eml_bytes / eml_ms / 1e3, html_ms, html_bytes / html_ms / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+// Markup parse time vs. nesting depth
+//
+// Parses machine-generated XML nested far deeper than any native call stack
+// would allow one frame per level (the last rows are 100k+ levels), then walks
+// the tree with both formatters into a sink that only counts bytes. The parser
+// and the formatters keep open elements on a heap stack, so every row
+// completes and the ns/level column stays flat. Formatted output grows with
+// the square of the depth (indentation), so it is reported but not timed.
+//
+//   g++ -O2 -std=c++20 -I../emlc markup_depth_bench.cpp -o markup_depth_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc markup_depth_bench.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eml.h"
+
+using namespace std;
+
+string make_nested_xml(int depth) {
+    string s;
+    for (int d = 0; d < depth; ++d) {
+        s += "<Node Level=\"" + to_string(d) + "\" Name=\"n" + to_string(d) + "\">";
+    }
+    s += "leaf";
+    for (int d = 0; d < depth; ++d) {
+        s += "</Node>";
+    }
+    return s;
+}
+
+// Discards the output, keeping only its size
+class CountingSink : public BufferedSink {
+public:
+    CountingSink() : BufferedSink(size_t(1) << 16) {}
+
+protected:
+    void drain(const char*, size_t) override {}
+};
+
+double time_parse_ms(const string& doc, int reps) {
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        Parser p;
+        Document parsed = p.parse(string(doc), false);
+        auto t1 = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+size_t formatted_size(Formatter& f, Node* root) {
+    CountingSink out;
+    f.format(root, out);
+    out.flush();
+    return out.bytes_written();
+}
+
+int main(int argc, char* argv[]) {
+    int max_depth = argc > 1 ? atoi(argv[1]) : 122880;
+
+    EmlFormatter eml;
+    MarkupFormatter xml(true);
+
+    printf("%8s %12s %12s %12s %14s %14s\n", "depth", "bytes", "parse ms", "ns/level", "eml bytes", "xml bytes");
+    for (int depth = 15; depth <= max_depth; depth *= 2) {
+        string doc = make_nested_xml(depth);
+        double ms = time_parse_ms(doc, 5);
+
+        Parser p;
+        Document parsed = p.parse(string(doc), false);
+        size_t eml_bytes = formatted_size(eml, parsed.root);
+        size_t xml_bytes = formatted_size(xml, parsed.root);
+        printf("%8d %12zu %12.3f %12.1f %14zu %14zu\n", depth, doc.size(), ms, ms * 1e6 / depth, eml_bytes, xml_bytes);
+    }
+    return 0;
+}
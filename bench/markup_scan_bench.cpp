@@ -0,0 +1,60 @@
+// Markup parse throughput with each set of scanning kernels
+//
+// Parses attribute-heavy XAML-style documents - short names and values, and
+// long data-binding / style values - with the scalar, SSE2 and AVX2 kernels
+// (see scan.h) and reports MB/s for each. Kernels the CPU or build lacks are
+// skipped.
+//
+//   g++ -O2 -std=c++20 -I../emlc markup_scan_bench.cpp -o markup_scan_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc markup_scan_bench.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eml.h"
+
+using namespace std;
+
+string make_xaml(int items, int value_len) {
+    string filler(value_len, 'x');
+    for (int i = 0; i < value_len; i += 9) filler[i] = ' ';
+    string s = "<Grid xmlns=\"http://schemas.microsoft.com/winfx/2006/xaml/presentation\">\n";
+    for (int i = 0; i < items; ++i) {
+        s += "  <StackPanel Orientation=\"Vertical\" Margin=\"" + to_string(i % 8) + "\" Tag=\"" + filler + "\">\n";
+        s += "    <TextBlock Text=\"{Binding Items[" + to_string(i) + "].Title, Mode=OneWay}\" FontSize=\"12\" ToolTip=\"" + filler + "\" />\n";
+        s += "    <Button Content=\"Go\" Width=\"80\" Command=\"{Binding OpenCommand}\" CommandParameter=\"" + to_string(i) + "\" />\n";
+        s += "  </StackPanel>\n";
+    }
+    return s + "</Grid>\n";
+}
+
+double time_parse_ms(const string& doc, int reps) {
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        Parser p;
+        Document parsed = p.parse(string(doc), false);
+        auto t1 = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int items = argc > 1 ? atoi(argv[1]) : 50000;
+    const ScanIsa best = scan_isa;
+    const char* names[] = {"scalar", "sse2", "avx2"};
+
+    printf("%10s %12s %10s %10s %10s\n", "value len", "bytes", "kernels", "ms", "MB/s");
+    for (int value_len : {4, 32, 128}) {
+        string doc = make_xaml(items, value_len);
+        for (int isa = SCAN_SCALAR; isa <= best; ++isa) {
+            scan_isa = ScanIsa(isa);
+            double ms = time_parse_ms(doc, 5);
+            printf("%10d %12zu %10s %10.2f %10.1f\n", value_len, doc.size(), names[isa], ms, doc.size() / ms / 1e3);
+        }
+    }
+    scan_isa = best;
+    return 0;
+}
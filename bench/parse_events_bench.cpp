@@ -0,0 +1,81 @@
+// Building the tree vs. reading parse events
+//
+// Collects every href in generated EML and HTML documents twice: by parsing
+// into a Document and walking its nodes, and by reading Parser events with no
+// tree at all. Checks both find the same links and reports MB/s for each.
+//
+//   g++ -O2 -std=c++20 -I../emlc parse_events_bench.cpp -o parse_events_bench
+//   cl /O2 /std:c++20 /EHsc /I..\emlc parse_events_bench.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eml.h"
+#include "corpus.h"
+
+using namespace std;
+
+size_t links_from_tree(const string& doc, bool eml) {
+    Parser p;
+    p.html = !eml;
+    Document parsed = p.parse(doc, eml);
+    size_t links = 0;
+    vector<Node*> stack = {parsed.root};
+    while (!stack.empty()) {
+        Node* n = stack.back();
+        stack.pop_back();
+        for (const Attribute& a : n->attrs) links += a.key.text() == "href";
+        stack.insert(stack.end(), n->children.begin(), n->children.end());
+    }
+    return links;
+}
+
+size_t links_from_events(const string& doc, bool eml) {
+    Parser p;
+    p.html = !eml;
+    size_t links = 0;
+    p.read_events(doc, eml, [&](const ParseEvent& e) {
+        if (e.type == EVENT_START) {
+            for (const EventAttr& a : e.attrs) links += a.key == "href";
+        }
+        return true;
+    });
+    return links;
+}
+
+template <class F>
+double best_ms(int reps, size_t& result, const F& fn) {
+    double best = 1e300;
+    for (int r = 0; r < reps; ++r) {
+        auto t0 = chrono::steady_clock::now();
+        result = fn();
+        auto t1 = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    size_t mb = argc > 1 ? size_t(atoi(argv[1])) : 16;
+
+    printf("%6s %12s %8s %10s %10s %10s\n", "input", "bytes", "links", "tree MB/s", "event MB/s", "speedup");
+    for (CorpusFormat format : {CORPUS_EML, CORPUS_HTML}) {
+        CorpusSpec spec;
+        spec.format = format;
+        spec.bytes = mb << 20;
+        string doc = make_corpus(spec);
+        bool eml = format == CORPUS_EML;
+
+        size_t tree_links, event_links;
+        double tree_ms = best_ms(5, tree_links, [&] { return links_from_tree(doc, eml); });
+        double event_ms = best_ms(5, event_links, [&] { return links_from_events(doc, eml); });
+        if (tree_links != event_links) {
+            printf("%s: the tree has %zu links, the events %zu\n", CORPUS_FORMAT_NAMES[format], tree_links, event_links);
+            return 1;
+        }
+        printf("%6s %12zu %8zu %10.1f %10.1f %9.2fx\n", CORPUS_FORMAT_NAMES[format], doc.size(), tree_links,
+               doc.size() / tree_ms / 1e3, doc.size() / event_ms / 1e3, tree_ms / event_ms);
+    }
+    return 0;
+}
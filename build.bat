@@ -22,6 +22,14 @@ if exist %VCVARS% (
         exit /b 1
     )
 
+    REM libemlc: emlc.dll and its import library emlc.lib
+    MSBuild emlc\libemlc.vcxproj /p:Configuration=%CONFIG% /p:Platform=x64
+
+    if errorlevel 1 (
+        echo Build failed
+        exit /b 1
+    )
+
     REM Copy output to current directory for convenience
     if exist "emlc\x64\%CONFIG%\emlc.exe" (
         copy /Y "emlc\x64\%CONFIG%\emlc.exe" "emlc.exe"
@@ -29,6 +37,10 @@ if exist %VCVARS% (
     ) else (
         echo Error: Build succeeded but output file not found at expected path: emlc\x64\%CONFIG%\emlc.exe
     )
+    if exist "emlc\x64\%CONFIG%\libemlc\emlc.dll" (
+        copy /Y "emlc\x64\%CONFIG%\libemlc\emlc.dll" "emlc.dll"
+        copy /Y "emlc\x64\%CONFIG%\libemlc\emlc.lib" "emlc.lib"
+    )
 ) else (
     echo Error: Visual Studio not found at expected path
     echo Please update VCVARS path in this script
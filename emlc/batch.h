@@ -0,0 +1,269 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "convert.h"
+
+using namespace std;
+
+// ======================
+// Work-Stealing Pool
+// ======================
+// Runs a fixed set of jobs on N threads. Each worker owns a deque of job
+// indices: it takes work from the front of its own deque and, once that is
+// empty, steals from the back of someone else's. A worker stuck on one huge
+// file does not hold up the small ones dealt to it.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads = 0)
+        : threads(threads ? threads : max(1u, thread::hardware_concurrency())) {}
+
+    unsigned size() const { return threads; }
+
+    // Call fn(job, worker) for every job in [0, count) and wait for all of them.
+    // `worker` is in [0, size()) and identifies the calling thread, so per-thread
+    // state can live in a plain vector indexed by it.
+    void run(size_t count, const function<void(size_t, unsigned)>& fn) {
+        vector<Queue> queues(threads);
+        // Deal contiguous runs so each worker starts on neighbouring jobs
+        for (unsigned w = 0; w < threads; ++w) {
+            size_t first = count * w / threads;
+            size_t last = count * (w + 1) / threads;
+            for (size_t j = first; j < last; ++j) queues[w].jobs.push_back(j);
+        }
+
+        auto work = [&](unsigned w) {
+            size_t job;
+            while (next_job(queues, w, job)) fn(job, w);
+        };
+        vector<thread> pool;
+        for (unsigned w = 1; w < threads; ++w) pool.emplace_back(work, w);
+        work(0); // the calling thread is worker 0
+        for (auto& t : pool) t.join();
+    }
+
+private:
+    struct Queue {
+        mutex lock;
+        deque<size_t> jobs;
+    };
+
+    // No jobs are added once a run starts, so when every deque is empty we are done
+    static bool next_job(vector<Queue>& queues, unsigned self, size_t& job) {
+        {
+            lock_guard<mutex> guard(queues[self].lock);
+            if (!queues[self].jobs.empty()) {
+                job = queues[self].jobs.front();
+                queues[self].jobs.pop_front();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Queue& victim = queues[(self + k) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    unsigned threads;
+};
+
+// ======================
+// Batch Conversion
+// ======================
+struct BatchJob {
+    string input;
+    string output;
+    OutputFormat format;
+};
+
+// Input extensions picked up when a tree is converted to EML
+const vector<string> MARKUP_EXTENSIONS = {".html", ".xml", ".php", ".xaml", ".fxml"};
+
+// A source tree mirrored into an output tree: every convertible file under
+// input_dir maps to the same relative path under output_dir, with the
+// extension swapped for `to_ext`. Converting to .eml picks up markup files,
+// anything else picks up .eml files.
+struct TreeMapping {
+    string input_dir;
+    string output_dir;
+    string to_ext;
+    OutputFormat format;
+
+    TreeMapping(string input_dir, string output_dir, string ext)
+        : input_dir(std::move(input_dir)), output_dir(std::move(output_dir)), to_ext(std::move(ext)) {
+        if (!to_ext.empty() && to_ext[0] != '.') to_ext = "." + to_ext;
+        format = output_format_for(to_ext);
+    }
+
+    bool wants(const filesystem::path& file) const {
+        string ext = file.extension().string();
+        if (format == FORMAT_EML) {
+            return find(MARKUP_EXTENSIONS.begin(), MARKUP_EXTENSIONS.end(), ext) != MARKUP_EXTENSIONS.end();
+        }
+        return ext == ".eml";
+    }
+
+    BatchJob job_for(const filesystem::path& file) const {
+        error_code ec;
+        filesystem::path out = filesystem::path(output_dir) / filesystem::relative(file, input_dir, ec);
+        out.replace_extension(to_ext);
+        return {file.string(), out.string(), format};
+    }
+};
+
+// One job per convertible file in the tree
+inline bool list_tree_jobs(const TreeMapping& tree, vector<BatchJob>& jobs, string& error) {
+    namespace fs = std::filesystem;
+    error_code ec;
+    if (!fs::is_directory(tree.input_dir, ec)) {
+        error = "Could not open directory " + tree.input_dir;
+        return false;
+    }
+    fs::create_directories(tree.output_dir, ec);
+    if (ec) {
+        error = "Could not create directory " + tree.output_dir;
+        return false;
+    }
+
+    fs::recursive_directory_iterator it(tree.input_dir, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        const fs::path& path = it->path();
+        if (it->is_directory(ec)) {
+            // Don't descend into the output tree when it sits inside the input tree
+            if (fs::equivalent(path, tree.output_dir, ec)) it.disable_recursion_pending();
+            ec.clear();
+            continue;
+        }
+        if (it->is_regular_file(ec) && tree.wants(path)) jobs.push_back(tree.job_for(path));
+    }
+    if (ec) {
+        error = "Could not read directory " + tree.input_dir + ": " + ec.message();
+        return false;
+    }
+
+    // Directory order is unspecified; keep runs (and error reports) repeatable
+    sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a.input < b.input; });
+    return true;
+}
+
+// Manifest: one conversion per line, "<input> <output> [format]". Fields are
+// tab-separated when the line has a tab (so paths may contain spaces),
+// otherwise whitespace-separated. `format` is an output extension such as
+// html, php or xaml; without it the output extension decides. Blank lines and
+// lines starting with # are skipped. Paths are relative to the working directory.
+inline bool read_manifest(const string& path, vector<BatchJob>& jobs, string& error) {
+    ifstream manifest(path);
+    if (!manifest.is_open()) {
+        error = "Could not open manifest " + path;
+        return false;
+    }
+
+    string line;
+    size_t line_no = 0;
+    while (getline(manifest, line)) {
+        line_no++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        string_view rest = trim(line);
+        if (rest.empty() || rest[0] == '#') continue;
+
+        bool tabs = rest.find('\t') != string_view::npos;
+        vector<string> fields;
+        while (!rest.empty()) {
+            size_t cut = tabs ? rest.find('\t') : rest.find_first_of(" \t");
+            fields.push_back(string(trim(rest.substr(0, cut))));
+            rest = cut == string_view::npos ? string_view() : trim(rest.substr(cut + 1));
+        }
+        if (fields.size() < 2 || fields.size() > 3) {
+            error = path + ":" + to_string(line_no) + ": expected <input> <output> [format]";
+            return false;
+        }
+
+        OutputFormat format = fields.size() == 3 ? output_format_for("." + fields[2]) : output_format_for(fields[1]);
+        jobs.push_back({fields[0], fields[1], format});
+    }
+    return true;
+}
+
+// Convert every job on a work-stealing pool, one Converter per worker. Failed
+// files are reported on stderr in job order and do not stop the others. With
+// `stats`, every worker measures its conversions and the totals are added to it.
+// Returns the number of files that failed.
+inline size_t run_batch(const vector<BatchJob>& jobs, unsigned threads, BuildCache* cache = nullptr,
+                        ConvertStats* stats = nullptr, const OutputOptions& output = {}) {
+    namespace fs = std::filesystem;
+
+    // Create output directories up front rather than racing on them in the workers
+    set<fs::path> dirs;
+    for (const auto& job : jobs) {
+        fs::path parent = fs::path(job.output).parent_path();
+        if (!parent.empty()) dirs.insert(parent);
+    }
+    for (const auto& dir : dirs) {
+        error_code ec;
+        fs::create_directories(dir, ec); // a failure shows up as that file's open error
+    }
+
+    WorkStealingPool pool(threads);
+    vector<Converter> converters(pool.size());
+    vector<ConvertStats> worker_stats(stats ? pool.size() : 0);
+    for (size_t w = 0; w < converters.size(); ++w) {
+        converters[w].cache = cache;
+        converters[w].output = output;
+        if (stats) converters[w].stats = &worker_stats[w];
+    }
+    vector<string> errors(jobs.size());
+
+    auto t0 = chrono::steady_clock::now();
+    pool.run(jobs.size(), [&](size_t i, unsigned worker) {
+        const BatchJob& job = jobs[i];
+        try {
+            if (!converters[worker].convert(job.input, job.output, job.format, errors[i]) && errors[i].empty()) {
+                errors[i] = "Could not convert " + job.input;
+            }
+        } catch (const exception& e) {
+            errors[i] = job.input + ": " + e.what();
+        }
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    size_t failed = 0;
+    for (const auto& error : errors) {
+        if (error.empty()) continue;
+        cerr << "Error: " << error << endl;
+        failed++;
+    }
+
+    size_t bytes_in = 0, bytes_out = 0;
+    for (const auto& c : converters) {
+        bytes_in += c.bytes_in;
+        bytes_out += c.bytes_out;
+    }
+    for (const auto& s : worker_stats) stats->add(s);
+    double secs = max(seconds, 1e-9);
+    size_t converted = jobs.size() - failed;
+    cout << "Converted " << converted << " of " << jobs.size() << " files in " << seconds << " s on "
+         << pool.size() << (pool.size() == 1 ? " thread" : " threads") << endl;
+    cout << "  " << size_t(converted / secs) << " files/s, " << bytes_in / secs / 1e6 << " MB/s in, "
+         << bytes_out / secs / 1e6 << " MB/s out" << endl;
+    if (cache) {
+        cout << "  cache: " << cache->hits << " hits, " << cache->misses << " misses, "
+             << cache->unchanged << " outputs already up to date" << endl;
+    }
+    return failed;
+}
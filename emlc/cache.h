@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "eml.h"
+#include "files.h"
+
+#ifdef _WIN32
+#include <process.h>
+#endif
+
+using namespace std;
+
+// ======================
+// Content Hash
+// ======================
+// MurmurHash3 x64 128-bit: fast (several GB/s) and wide enough that two
+// different inputs landing on the same cache entry is not a practical concern.
+// Not cryptographic; the cache trusts whoever can write to its directory.
+struct Hash128 {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator==(const Hash128&) const = default;
+
+    string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        string s(32, '0');
+        for (int i = 0; i < 16; ++i) {
+            uint64_t v = i < 8 ? hi : lo;
+            unsigned byte = unsigned(v >> (8 * (7 - i % 8))) & 0xff;
+            s[2 * i] = digits[byte >> 4];
+            s[2 * i + 1] = digits[byte & 15];
+        }
+        return s;
+    }
+};
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+inline Hash128 hash128(string_view data, uint64_t seed = 0) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data());
+    size_t n = data.size();
+    uint64_t h1 = seed, h2 = seed;
+
+    size_t blocks = n / 16;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t k1, k2;
+        memcpy(&k1, p + i * 16, 8);
+        memcpy(&k2, p + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // Tail: up to 15 bytes, little-endian into k1 (first 8) and k2 (rest)
+    const unsigned char* tail = p + blocks * 16;
+    uint64_t k1 = 0, k2 = 0;
+    size_t rest = n & 15;
+    for (size_t i = rest; i > 8; --i) k2 |= uint64_t(tail[i - 1]) << (8 * (i - 9));
+    for (size_t i = min<size_t>(rest, 8); i > 0; --i) k1 |= uint64_t(tail[i - 1]) << (8 * (i - 1));
+    if (rest > 8) { k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2; }
+    if (rest > 0) { k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1; }
+
+    h1 ^= uint64_t(n);
+    h2 ^= uint64_t(n);
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return {h1, h2};
+}
+
+// ======================
+// Build Cache
+// ======================
+// On-disk cache of converted outputs, keyed by the input bytes, how they are
+// parsed (EML, HTML or XML), the output format, whether it is minified,
+// the emlc version and the output revision. A compressed copy of an output
+// is an entry of its own, named by codec and level:
+//
+//   <dir>/<version>-r<revision>/<first two hex digits>/<rest>.<in>-<out>[-min][.<codec><level>]
+//
+// Entries are written to a temp file and renamed into place, so concurrent
+// workers (or processes) sharing a cache never see half-written entries.
+// Outputs are hard links to their entry where the filesystem allows, copies
+// otherwise; OutputFile unlinks a linked output before rewriting it, so a
+// later run without the cache never writes through into an entry.
+class BuildCache {
+public:
+    atomic<size_t> hits{0};      // outputs taken from the cache
+    atomic<size_t> misses{0};    // outputs that had to be converted
+    atomic<size_t> unchanged{0}; // outputs that already held the right bytes and were left alone
+
+    explicit BuildCache(string dir) : root(filesystem::path(dir) / (VERSION + "-r" + to_string(OUTPUT_REVISION))) {}
+
+    bool open(string& error) {
+        error_code ec;
+        filesystem::create_directories(root, ec);
+        if (ec) {
+            error = "Could not create cache directory " + root.string();
+            return false;
+        }
+        return true;
+    }
+
+    string entry_for(string_view input, OutputFormat input_format, OutputFormat format, bool minified = false) const {
+        static const char* format_names[] = {"eml", "html", "xml", "emlb"};
+        string hex = hash128(input).hex();
+        string name = hex.substr(2) + "." + format_names[input_format] + "-" + format_names[format] + (minified ? "-min" : "");
+        return (root / hex.substr(0, 2) / name).string();
+    }
+
+    bool contains(const string& entry) const {
+        error_code ec;
+        return filesystem::is_regular_file(entry, ec);
+    }
+
+    // Unique scratch file next to `path`; rename it over `path` to publish
+    string temp_for(const string& path) {
+        error_code ec;
+        filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+        return path + ".tmp" + to_string(process_id()) + "-" + to_string(next_temp++);
+    }
+
+    bool publish(const string& temp, const string& path) {
+        error_code ec;
+        filesystem::rename(temp, path, ec);
+        if (ec) filesystem::remove(temp, ec);
+        return !ec;
+    }
+
+    // Make `output` hold the entry's bytes. If it already does it is not
+    // touched, so its mtime only moves when its content does.
+    bool install(const string& entry, const string& output, string& error) {
+        namespace fs = std::filesystem;
+        error_code ec;
+        if (fs::equivalent(entry, output, ec) || same_content(entry, output)) {
+            unchanged++;
+            return true;
+        }
+
+        // Link (or copy) to a temp name and rename it over the output, so the
+        // output is replaced atomically and never written through a link
+        string temp = temp_for(output);
+        ec.clear();
+        fs::create_hard_link(entry, temp, ec);
+        if (ec) {
+            ec.clear();
+            fs::copy_file(entry, temp, fs::copy_options::overwrite_existing, ec);
+        }
+        if (ec || !publish(temp, output)) {
+            fs::remove(temp, ec);
+            error = "Could not write output " + output;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    filesystem::path root;
+    atomic<size_t> next_temp{0};
+
+    static long process_id() {
+#ifdef _WIN32
+        return long(_getpid());
+#else
+        return long(getpid());
+#endif
+    }
+
+    static bool same_content(const string& a, const string& b) {
+        error_code ec;
+        auto size_a = filesystem::file_size(a, ec);
+        if (ec) return false;
+        auto size_b = filesystem::file_size(b, ec);
+        if (ec || size_a != size_b) return false;
+        auto fa = load_input(a), fb = load_input(b);
+        return fa && fb && fa->text() == fb->text();
+    }
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "eml.h"
+#include "files.h"
+
+#ifdef EMLC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef EMLC_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef EMLC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+// ======================
+// Compression Codecs
+// ======================
+// Precompressed copies of an output (index.html.gz, index.html.br, ...) for
+// servers that send them as they are. Each codec is built in only when its
+// library was found at build time (EMLC_HAVE_ZLIB, EMLC_HAVE_BROTLI,
+// EMLC_HAVE_ZSTD).
+enum Codec {
+    CODEC_NONE, // the plain output
+    CODEC_GZIP,
+    CODEC_BROTLI,
+    CODEC_ZSTD
+};
+
+struct CodecInfo {
+    const char* name;      // as given to --compress
+    const char* extension; // appended to the output path
+    int min_level;
+    int max_level;
+    int default_level; // the smallest output: these are compressed once and served many times
+    bool built_in;
+};
+
+inline const CodecInfo& codec_info(Codec codec) {
+    static const CodecInfo codecs[] = {
+        {"none", "", 0, 0, 0, true},
+#ifdef EMLC_HAVE_ZLIB
+        {"gz", ".gz", 1, 9, 9, true},
+#else
+        {"gz", ".gz", 1, 9, 9, false},
+#endif
+#ifdef EMLC_HAVE_BROTLI
+        {"br", ".br", 0, 11, 11, true},
+#else
+        {"br", ".br", 0, 11, 11, false},
+#endif
+#ifdef EMLC_HAVE_ZSTD
+        {"zst", ".zst", 1, 22, 19, true},
+#else
+        {"zst", ".zst", 1, 22, 19, false},
+#endif
+    };
+    return codecs[codec];
+}
+
+struct Compression {
+    Codec codec = CODEC_NONE;
+    int level = 0;
+
+    // Names the codec and level in build cache entries, e.g. "br11"
+    string tag() const { return codec_info(codec).extension + 1 + to_string(level); }
+};
+
+// Parse a --compress list: codec names separated by commas, each with an
+// optional ":<level>", e.g. "gz,br:9". On failure returns false and describes
+// why in `error`.
+inline bool parse_compression(string_view spec, vector<Compression>& out, string& error) {
+    while (true) {
+        size_t comma = spec.find(',');
+        string_view item = trim(spec.substr(0, comma));
+        string_view name = item.substr(0, item.find(':'));
+        Compression c;
+        if (name == "gz" || name == "gzip") c.codec = CODEC_GZIP;
+        else if (name == "br" || name == "brotli") c.codec = CODEC_BROTLI;
+        else if (name == "zst" || name == "zstd") c.codec = CODEC_ZSTD;
+        else {
+            error = "Unknown compression \"" + string(name) + "\" (expected gz, br or zst)";
+            return false;
+        }
+        const CodecInfo& info = codec_info(c.codec);
+        if (!info.built_in) {
+            error = "This emlc was built without " + string(info.name) + " support";
+            return false;
+        }
+        c.level = info.default_level;
+        if (name.size() < item.size()) {
+            string level(item.substr(name.size() + 1));
+            char* end = nullptr;
+            long value = strtol(level.c_str(), &end, 10);
+            if (level.empty() || *end || value < info.min_level || value > info.max_level) {
+                error = "Compression level for " + string(info.name) + " must be " + to_string(info.min_level) +
+                        " to " + to_string(info.max_level);
+                return false;
+            }
+            c.level = int(value);
+        }
+        out.push_back(c);
+        if (comma == string_view::npos) return true;
+        spec = spec.substr(comma + 1);
+    }
+}
+
+// A compressed stream being written to a sink
+class Encoder {
+public:
+    virtual ~Encoder() {}
+
+    // Compress `data` into `out`; `last` ends the stream. False if the codec fails.
+    virtual bool encode(string_view data, bool last, Sink& out) = 0;
+};
+
+#ifdef EMLC_HAVE_ZLIB
+class GzipEncoder : public Encoder {
+public:
+    explicit GzipEncoder(int level) {
+        ready = deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) == Z_OK; // 16: gzip wrapper
+    }
+    ~GzipEncoder() override {
+        if (ready) deflateEnd(&z);
+    }
+
+    bool encode(string_view data, bool last, Sink& out) override {
+        if (!ready) return false;
+        do {
+            // avail_in is 32 bits
+            size_t n = min<size_t>(data.size(), 1u << 30);
+            int flush = last && n == data.size() ? Z_FINISH : Z_NO_FLUSH;
+            z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+            z.avail_in = uInt(n);
+            do {
+                z.next_out = reinterpret_cast<Bytef*>(buf);
+                z.avail_out = sizeof buf;
+                if (deflate(&z, flush) == Z_STREAM_ERROR) return false;
+                out.write(string_view(buf, sizeof buf - z.avail_out));
+            } while (z.avail_out == 0);
+            data.remove_prefix(n);
+        } while (!data.empty());
+        return true;
+    }
+
+private:
+    z_stream z{};
+    bool ready = false;
+    char buf[1 << 16];
+};
+#endif
+
+#ifdef EMLC_HAVE_BROTLI
+class BrotliEncoder : public Encoder {
+public:
+    explicit BrotliEncoder(int level) : state(BrotliEncoderCreateInstance(nullptr, nullptr, nullptr)) {
+        if (!state) return;
+        BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, uint32_t(level));
+        BrotliEncoderSetParameter(state, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+    }
+    ~BrotliEncoder() override {
+        if (state) BrotliEncoderDestroyInstance(state);
+    }
+
+    bool encode(string_view data, bool last, Sink& out) override {
+        if (!state) return false;
+        const uint8_t* next_in = reinterpret_cast<const uint8_t*>(data.data());
+        size_t avail_in = data.size();
+        BrotliEncoderOperation op = last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+        while (true) {
+            // No output buffer of our own: take what the encoder has ready
+            size_t avail_out = 0;
+            if (!BrotliEncoderCompressStream(state, op, &avail_in, &next_in, &avail_out, nullptr, nullptr)) return false;
+            size_t size = 0;
+            const uint8_t* ready = BrotliEncoderTakeOutput(state, &size);
+            if (size) out.write(string_view(reinterpret_cast<const char*>(ready), size));
+            if (avail_in == 0 && !BrotliEncoderHasMoreOutput(state) && (!last || BrotliEncoderIsFinished(state))) return true;
+        }
+    }
+
+private:
+    BrotliEncoderState* state;
+};
+#endif
+
+#ifdef EMLC_HAVE_ZSTD
+class ZstdEncoder : public Encoder {
+public:
+    explicit ZstdEncoder(int level) : cctx(ZSTD_createCCtx()) {
+        if (cctx) ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    }
+    ~ZstdEncoder() override { ZSTD_freeCCtx(cctx); }
+
+    bool encode(string_view data, bool last, Sink& out) override {
+        if (!cctx) return false;
+        ZSTD_inBuffer in{data.data(), data.size(), 0};
+        ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+        while (true) {
+            ZSTD_outBuffer o{buf, sizeof buf, 0};
+            size_t left = ZSTD_compressStream2(cctx, &o, &in, mode);
+            if (ZSTD_isError(left)) return false;
+            out.write(string_view(buf, o.pos));
+            if (last ? left == 0 : in.pos == in.size) return true;
+        }
+    }
+
+private:
+    ZSTD_CCtx* cctx;
+    char buf[1 << 16];
+};
+#endif
+
+// An encoder for a built-in codec, null for CODEC_NONE
+inline unique_ptr<Encoder> make_encoder(const Compression& c) {
+    switch (c.codec) {
+#ifdef EMLC_HAVE_ZLIB
+        case CODEC_GZIP: return make_unique<GzipEncoder>(c.level);
+#endif
+#ifdef EMLC_HAVE_BROTLI
+        case CODEC_BROTLI: return make_unique<BrotliEncoder>(c.level);
+#endif
+#ifdef EMLC_HAVE_ZSTD
+        case CODEC_ZSTD: return make_unique<ZstdEncoder>(c.level);
+#endif
+        default: return nullptr;
+    }
+}
+
+// ======================
+// Output Sets
+// ======================
+struct OutputTarget {
+    string path;
+    Compression compression; // CODEC_NONE for the plain output
+};
+
+// One formatting pass written to several files: the plain output and/or
+// compressed copies of it. Small outputs are compressed when the set is
+// closed. Once an output outgrows the staging buffer, each compressed copy is
+// encoded on a thread of its own, a few chunks behind the formatter, so the
+// slow codecs run alongside formatting rather than after it.
+class OutputSet : public BufferedSink {
+public:
+    string unopened; // the first path that could not be opened, or ""
+
+    explicit OutputSet(const vector<OutputTarget>& targets) : BufferedSink(size_t(1) << 20) {
+        for (const auto& t : targets) {
+            auto target = make_unique<Target>(t.path, t.compression.codec != CODEC_NONE);
+            target->encoder = make_encoder(t.compression);
+            if (!target->file.is_open() && unopened.empty()) unopened = t.path;
+            files.push_back(std::move(target));
+        }
+        if (!unopened.empty()) failed = true;
+    }
+    ~OutputSet() override { close(); }
+
+    OutputSet(const OutputSet&) = delete;
+    OutputSet& operator=(const OutputSet&) = delete;
+
+    bool is_open() const { return unopened.empty(); }
+
+    // Bytes written to all the files so far
+    size_t file_bytes() const {
+        size_t n = 0;
+        for (const auto& t : files) n += t->file.bytes_written();
+        return n;
+    }
+
+    // Finish every stream and close every file; false if any write failed
+    bool close() {
+        if (closed) return ok();
+        closing = true;
+        flush();
+        for (auto& t : files) {
+            if (!t->encoder) continue;
+            if (t->worker.joinable()) {
+                {
+                    lock_guard<mutex> guard(t->lock);
+                    t->done = true;
+                }
+                t->ready.notify_all();
+                t->worker.join();
+            } else if (!t->encoder->encode(string_view(), true, t->file)) {
+                t->encoded = false;
+            }
+        }
+        for (auto& t : files) {
+            if (!t->file.close() || !t->encoded) failed = true;
+        }
+        closed = true;
+        return ok();
+    }
+
+protected:
+    void drain(const char* data, size_t n) override {
+        string_view chunk(data, n);
+        if (!closing && !threaded) start_workers();
+        shared_ptr<const string> queued; // one copy shared by every worker
+        for (auto& t : files) {
+            if (!t->encoder) {
+                t->file.write(chunk);
+            } else if (t->worker.joinable()) {
+                if (!queued) queued = make_shared<const string>(chunk);
+                unique_lock<mutex> guard(t->lock);
+                t->ready.wait(guard, [&] { return t->queue.size() < MAX_QUEUED; });
+                t->queue.push_back(queued);
+                guard.unlock();
+                t->ready.notify_all();
+            } else if (!t->encoder->encode(chunk, false, t->file)) {
+                t->encoded = false;
+            }
+        }
+    }
+
+private:
+    struct Target {
+        OutputFile file;
+        unique_ptr<Encoder> encoder; // null for the plain output
+        bool encoded = true;         // false once the encoder fails
+
+        // When encoding on its own thread: chunks not yet encoded
+        thread worker;
+        mutex lock;
+        condition_variable ready;
+        deque<shared_ptr<const string>> queue;
+        bool done = false; // no more chunks will come
+
+        Target(const string& path, bool binary) : file(path, binary) {}
+    };
+
+    static constexpr size_t MAX_QUEUED = 4; // chunks a worker may fall behind before the formatter waits
+
+    vector<unique_ptr<Target>> files;
+    bool threaded = false;
+    bool closing = false;
+    bool closed = false;
+
+    void start_workers() {
+        threaded = true;
+        for (auto& t : files) {
+            if (t->encoder) t->worker = thread(&OutputSet::encode_queued, t.get());
+        }
+    }
+
+    static void encode_queued(Target* t) {
+        while (true) {
+            shared_ptr<const string> chunk;
+            {
+                unique_lock<mutex> guard(t->lock);
+                t->ready.wait(guard, [&] { return !t->queue.empty() || t->done; });
+                if (t->queue.empty()) break;
+                chunk = std::move(t->queue.front());
+                t->queue.pop_front();
+            }
+            t->ready.notify_all();
+            if (t->encoded && !t->encoder->encode(*chunk, false, t->file)) t->encoded = false;
+        }
+        if (t->encoded && !t->encoder->encode(string_view(), true, t->file)) t->encoded = false;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include "eml.h"
+#include "emlb.h"
+#include "compress.h"
+#include "stream.h"
+#include "files.h"
+#include "cache.h"
+#include "stats.h"
+
+using namespace std;
+
+// ======================
+// Conversion
+// ======================
+// How outputs are written, beyond their format
+struct OutputOptions {
+    bool minify = false; // HTML and XML on one line (see MarkupFormatter::minify)
+    vector<Compression> compress; // compressed copies written next to the output (--compress)
+    bool plain = true;            // write the output itself; false keeps only the compressed copies
+
+    // The files written for `path`: the output and its compressed copies
+    vector<OutputTarget> targets_for(const string& path) const {
+        vector<OutputTarget> targets;
+        if (plain || compress.empty()) targets.push_back({path, {}});
+        for (const auto& c : compress) targets.push_back({path + codec_info(c.codec).extension, c});
+        return targets;
+    }
+};
+
+// One conversion pipeline: a parser and one formatter of each kind. Keep one
+// per thread and reuse it for every file or buffer that thread converts.
+class Converter {
+public:
+    size_t bytes_in = 0;  // input bytes parsed so far
+    size_t bytes_out = 0; // output bytes written so far
+    BuildCache* cache = nullptr; // shared by every converter; null to always convert
+    bool last_hit = false;       // the last conversion was served from the cache
+    ConvertStats* stats = nullptr; // where to add measurements (--stats); null to measure nothing
+    unsigned threads = 1;          // for one large input at a time (see Parser::threads, Formatter::threads)
+    bool stream = false;           // HTML and XML to EML in bounded memory (see StreamDecompiler); bypasses the cache
+    OutputOptions output;
+
+    Formatter& formatter_for(OutputFormat format) {
+        switch (format) {
+            case FORMAT_EML: return eml;
+            case FORMAT_XML: return xml;
+            case FORMAT_EMLB: return emlb;
+            default: return html;
+        }
+    }
+
+    // Convert `input_path` into `output_path`, picking both formats from the file
+    // extensions. On failure returns false and describes why in `error`.
+    bool convert(const string& input_path, const string& output_path, string& error) {
+        return convert(input_path, output_path, output_format_for(output_path), error);
+    }
+
+    bool convert(const string& input_path, const string& output_path, OutputFormat format, string& error) {
+        OutputFormat input_format = output_format_for(input_path);
+        if (stream && format == FORMAT_EML && (input_format == FORMAT_HTML || input_format == FORMAT_XML)) {
+            return convert_stream(input_path, output_path, input_format, error);
+        }
+
+        PhaseClock clock(stats);
+        // Converting a file onto itself truncates it before it is parsed, so only
+        // map the input when the output is somewhere else
+        unique_ptr<SourceBuffer> content = load_input(input_path, !same_file(input_path, output_path));
+        if (!content) {
+            error = "Could not open " + input_path;
+            return false;
+        }
+        bytes_in += content->text().size();
+        last_hit = false;
+        if (stats) {
+            stats->files++;
+            stats->bytes_in += content->text().size();
+        }
+        clock.lap(&ConvertStats::read_ms);
+
+        if (cache) return convert_cached(std::move(content), input_format, output_path, format, clock, error);
+
+        Document doc;
+        if (!read_document(std::move(content), input_format, doc, error)) return false; // node strings are views into the input
+        clock.lap(&ConvertStats::parse_ms);
+
+        OutputSet outfile(output.targets_for(output_path));
+        if (!outfile.is_open()) {
+            error = "Could not open output " + outfile.unopened;
+            return false;
+        }
+        clock.lap(&ConvertStats::write_ms);
+        // Stream the output as it is formatted instead of building it in memory first
+        bool written = write_output(doc, format, outfile, clock);
+        count_output(outfile.file_bytes());
+        if (!written) {
+            error = "Could not write output " + output_path;
+            return false;
+        }
+        return true;
+    }
+
+    // Convert text in memory, appending the output to `out`. Touches no files
+    // and bypasses the cache. `input` is only read during the call. Throws
+    // runtime_error for an .emlb input that does not load.
+    void convert(string_view input, OutputFormat input_format, OutputFormat format, StringSink& out) {
+        PhaseClock clock(stats);
+        bytes_in += input.size();
+        last_hit = false;
+        if (stats) {
+            stats->files++;
+            stats->bytes_in += input.size();
+        }
+        Document doc;
+        string error;
+        if (!read_document(make_unique<ViewSource>(input), input_format, doc, error)) throw runtime_error(error);
+        clock.lap(&ConvertStats::parse_ms);
+
+        size_t before = out.size();
+        formatter_for(format, threads).format(doc.root, out);
+        count_output(out.size() - before);
+        if (stats) {
+            clock.lap(&ConvertStats::format_ms);
+            stats->count_document(doc);
+        }
+    }
+
+private:
+    Parser parser;
+    StreamDecompiler decompiler;
+    EmlFormatter eml;
+    MarkupFormatter html{false};
+    MarkupFormatter xml{true};
+    EmlbWriter emlb;
+
+    // The formatter for `format`, set up with the thread count and output options
+    Formatter& formatter_for(OutputFormat format, unsigned threads) {
+        html.minify = xml.minify = output.minify;
+        Formatter& formatter = formatter_for(format);
+        formatter.threads = threads;
+        return formatter;
+    }
+
+    // Parse `content` - EML, or markup read with HTML or XML rules - or load it
+    // when it is a saved tree. On failure returns false and describes why in `error`.
+    bool read_document(unique_ptr<SourceBuffer> content, OutputFormat input_format, Document& doc, string& error) {
+        if (input_format == FORMAT_EMLB) return load_emlb(std::move(content), doc, error);
+        parser.html = input_format == FORMAT_HTML;
+        parser.stats = stats ? &stats->blocks : nullptr;
+        parser.threads = threads;
+        doc = parser.parse(std::move(content), input_format == FORMAT_EML);
+        return true;
+    }
+
+    // Format `doc` into `outfile` and close it. The time spent in write calls
+    // goes to the write phase, the rest to format.
+    bool write_output(Document& doc, OutputFormat format, OutputSet& outfile, PhaseClock& clock) {
+        double drain_ms = 0;
+        if (stats) outfile.drain_ms = &drain_ms;
+        formatter_for(format, threads).format(doc.root, outfile);
+        bool closed = outfile.close();
+        if (stats) {
+            clock.lap(&ConvertStats::format_ms);
+            stats->format_ms -= drain_ms;
+            stats->write_ms += drain_ms;
+            stats->count_document(doc);
+        }
+        return closed;
+    }
+
+    // Decompile markup as it is read. Reading, parsing and formatting are
+    // interleaved, so --stats puts all of it under format.
+    bool convert_stream(const string& input_path, const string& output_path, OutputFormat input_format, string& error) {
+        PhaseClock clock(stats);
+        if (same_file(input_path, output_path)) {
+            error = "Cannot stream " + input_path + " onto itself";
+            return false;
+        }
+        InputStream in(input_path);
+        if (!in.is_open()) {
+            error = "Could not open " + input_path;
+            return false;
+        }
+        OutputSet outfile(output.targets_for(output_path));
+        if (!outfile.is_open()) {
+            error = "Could not open output " + outfile.unopened;
+            return false;
+        }
+        last_hit = false;
+        double drain_ms = 0;
+        if (stats) outfile.drain_ms = &drain_ms;
+        decompiler.html = input_format == FORMAT_HTML;
+        bool read = decompiler.decompile(in, outfile);
+        bool written = outfile.close();
+        bytes_in += in.bytes_read;
+        count_output(outfile.file_bytes());
+        if (stats) {
+            stats->files++;
+            stats->bytes_in += in.bytes_read;
+            clock.lap(&ConvertStats::format_ms);
+            stats->format_ms -= drain_ms;
+            stats->write_ms += drain_ms;
+        }
+        if (!read) {
+            error = "Could not read " + input_path;
+            return false;
+        }
+        if (!written) {
+            error = "Could not write output " + output_path;
+            return false;
+        }
+        return true;
+    }
+
+    void count_output(size_t bytes) {
+        bytes_out += bytes;
+        if (stats) stats->bytes_out += bytes;
+    }
+
+    // Convert into the cache unless the entries are already there, then install
+    // each entry as its output. Compressed copies have entries of their own.
+    bool convert_cached(unique_ptr<SourceBuffer> content, OutputFormat input_format, const string& output_path,
+                        OutputFormat format, PhaseClock& clock, string& error) {
+        string entry = cache->entry_for(content->text(), input_format, format, output.minify);
+        vector<OutputTarget> targets = output.targets_for(output_path);
+        vector<string> entries;
+        bool cached = true;
+        for (const auto& t : targets) {
+            entries.push_back(t.compression.codec == CODEC_NONE ? entry : entry + "." + t.compression.tag());
+            cached = cached && cache->contains(entries.back());
+        }
+        if (cached) {
+            cache->hits++;
+            last_hit = true;
+            if (stats) stats->cache_hits++;
+        } else {
+            cache->misses++;
+            Document doc;
+            if (!read_document(std::move(content), input_format, doc, error)) return false;
+            clock.lap(&ConvertStats::parse_ms);
+            vector<OutputTarget> temps = targets;
+            for (size_t i = 0; i < temps.size(); ++i) temps[i].path = cache->temp_for(entries[i]);
+            bool written;
+            {
+                OutputSet outfile(temps);
+                clock.lap(&ConvertStats::write_ms);
+                written = outfile.is_open() && write_output(doc, format, outfile, clock);
+            }
+            for (size_t i = 0; i < temps.size(); ++i) written = written && cache->publish(temps[i].path, entries[i]);
+            if (!written) {
+                error_code ec;
+                for (const auto& t : temps) filesystem::remove(t.path, ec);
+                error = "Could not write cache entry " + entry;
+                return false;
+            }
+        }
+
+        for (size_t i = 0; i < targets.size(); ++i) {
+            error_code ec;
+            auto size = filesystem::file_size(entries[i], ec);
+            if (!ec) count_output(size_t(size));
+            if (!cache->install(entries[i], targets[i].path, error)) return false;
+        }
+        clock.lap(&ConvertStats::write_ms);
+        return true;
+    }
+};
@@ -0,0 +1,2493 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+
+#include "scan.h"
+#include "sink.h"
+
+using namespace std;
+
+// ======================
+// Tag Tables
+// ======================
+// A fixed set of tag names with a perfect hash found at compile time: every
+// name has a slot of its own, so a lookup hashes the length and three bytes of
+// the tag, loads one slot and makes one comparison. No allocation, no tree walk.
+template <size_t N>
+class TagSet {
+public:
+    constexpr TagSet(const char* const (&list)[N]) {
+        for (seed = 0; seed < (1u << 16); ++seed) {
+            if (place(list)) return;
+        }
+        throw "no perfect hash for this tag set"; // evaluated at compile time: a build error
+    }
+
+    constexpr bool contains(string_view tag) const {
+        return !tag.empty() && slots[slot_of(tag, seed)] == tag;
+    }
+
+    // Whether `pred` holds for every name in the set
+    template <class Pred>
+    constexpr bool every(Pred pred) const {
+        for (string_view slot : slots) {
+            if (!slot.empty() && !pred(slot)) return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr unsigned BITS = N <= 6 ? 4 : N <= 12 ? 5 : N <= 24 ? 6 : 7; // at most ~40% full
+    string_view slots[size_t(1) << BITS] = {};
+    uint32_t seed = 0;
+
+    static constexpr size_t slot_of(string_view tag, uint32_t seed) {
+        uint32_t key = uint32_t(uint8_t(tag[0])) | uint32_t(uint8_t(tag[tag.size() / 2])) << 8
+            | uint32_t(uint8_t(tag.back())) << 16 | uint32_t(tag.size()) << 24;
+        uint32_t h = (key ^ seed) * 0x9E3779B1u;
+        h ^= h >> 16;
+        return (h * 0x85EBCA6Bu) >> (32 - BITS);
+    }
+
+    constexpr bool place(const char* const (&list)[N]) {
+        for (auto& slot : slots) slot = {};
+        for (const char* name : list) {
+            string_view& slot = slots[slot_of(name, seed)];
+            if (!slot.empty()) return false;
+            slot = name;
+        }
+        return true;
+    }
+};
+
+// HTML void elements: never have content or an end tag
+constexpr TagSet SELF_CLOSING_TAGS({
+    "area", "base", "br", "col", "embed", "hr", "img",
+    "input", "link", "meta", "param", "source", "track", "wbr"
+});
+
+// HTML elements whose end tag may be omitted; see implies_end_tag
+constexpr TagSet OPTIONAL_CLOSE_TAGS({
+    "li", "dt", "dd", "p", "rt", "rp", "optgroup", "option",
+    "thead", "tbody", "tfoot", "tr", "td", "th"
+});
+
+// Start tags that end an open <p>
+constexpr TagSet CLOSES_P_TAGS({
+    "address", "article", "aside", "blockquote", "details", "div", "dl", "fieldset",
+    "figcaption", "figure", "footer", "form", "h1", "h2", "h3", "h4", "h5", "h6",
+    "header", "hgroup", "hr", "main", "menu", "nav", "ol", "p", "pre", "section",
+    "table", "ul"
+});
+
+// EML blocks whose body is kept as raw text instead of being parsed
+constexpr TagSet RAW_TEXT_TAGS({"script", "style", "pre", "code", "php"});
+
+// HTML elements laid out as blocks or never rendered, besides CLOSES_P_TAGS and
+// the list and table parts of OPTIONAL_CLOSE_TAGS: whitespace next to their
+// tags does not show
+constexpr TagSet BLOCK_TAGS({
+    "html", "head", "body", "title", "meta", "link", "base", "caption", "colgroup", "col",
+    "legend", "summary", "dialog", "source", "track", "param"
+});
+
+// Parents in which a <p> keeps its end tag even as their last child
+constexpr TagSet P_END_REQUIRED_IN({"a", "audio", "del", "ins", "map", "noscript", "video"});
+
+// HTML elements that bound the search for an open element a start tag ends;
+// see bounds_implied_end
+constexpr TagSet IMPLIED_END_SCOPE_TAGS({
+    "button", "caption", "dl", "menu", "ol", "table", "td", "template", "th", "ul"
+});
+
+// Whether, in HTML, a start tag `next` ends the open element `open` without an
+// end tag of its own (<li> after <li>, <td> after <td>, <div> after <p>...).
+// Elements still open inside `open` end with it.
+inline bool implies_end_tag(string_view open, string_view next) {
+    if (!OPTIONAL_CLOSE_TAGS.contains(open)) return false;
+    if (open == "p") return CLOSES_P_TAGS.contains(next);
+    if (open == "li") return next == "li";
+    if (open == "dt" || open == "dd") return next == "dt" || next == "dd";
+    if (open == "rt" || open == "rp") return next == "rt" || next == "rp";
+    if (open == "option") return next == "option" || next == "optgroup";
+    if (open == "optgroup") return next == "optgroup";
+    bool section = next == "thead" || next == "tbody" || next == "tfoot";
+    if (open == "tr") return next == "tr" || section;
+    if (open == "td" || open == "th") return next == "td" || next == "th" || next == "tr" || section;
+    return section; // thead, tbody, tfoot
+}
+
+// Whether, in HTML, the open element `open` stops a start tag `next` from
+// ending elements outside it: a <td> or <li> inside a nested <table> or list
+// leaves the outer cell or item open, and a block inside a cell leaves a <p>
+// around the table open.
+inline bool bounds_implied_end(string_view open, string_view next) {
+    if (!IMPLIED_END_SCOPE_TAGS.contains(open)) return false;
+    if (open == "ul" || open == "ol" || open == "menu" || open == "dl") return next == "li" || next == "dt" || next == "dd";
+    return true; // button, caption, table, td, template, th
+}
+
+const string VERSION = "1.0";
+
+// Revision of the converted output. Bump it with any change that makes the
+// same input convert to different bytes, so build caches filled by an older
+// binary are not served as hits (see cache.h).
+constexpr int OUTPUT_REVISION = 1;
+
+// ======================
+// String References
+// ======================
+// A view of text owned by a Document (or a literal). Converts to std::string
+// implicitly so it can be used to look up the string tables.
+struct StrRef : string_view {
+    using string_view::string_view;
+    StrRef() : string_view("", 0) {} // never null, so it can always be memcpy'd
+    StrRef(string_view v) : string_view(v) {}
+
+    operator string() const { return string(data(), size()); }
+};
+
+// ======================
+// Helper Functions
+// ======================
+inline StrRef trim(string_view str) {
+    size_t first = str.find_first_not_of(" \t\n\r");
+    if (first == string::npos) return "";
+    size_t last = str.find_last_not_of(" \t\n\r");
+    return str.substr(first, last - first + 1);
+}
+
+inline bool ends_with(const string& str, const string& suffix) {
+    if (suffix.size() > str.size()) return false;
+    return str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+inline bool is_ident_start(char c) {
+    return isalpha(c) || c == '_';
+}
+
+inline bool is_ident_part(char c) {
+    return isalnum(c) || c == '-' || c == '_' || c == '.' || c == ':';
+}
+
+// ======================
+// Atoms
+// ======================
+// Tag and attribute names are interned: each distinct name is stored once and
+// nodes hold an Atom, a pointer to it, so two names are equal when their atoms
+// are and the text is only read back when output is written. The names HTML,
+// XAML, Android and FXML documents are made of are built in, along with which
+// tag tables they belong to; others are added to the Document they occur in.
+// Atoms of two documents compare equal only for built-in names.
+enum AtomFlag : uint32_t {
+    TAG_VOID = 1,           // SELF_CLOSING_TAGS
+    TAG_OPTIONAL_CLOSE = 2, // OPTIONAL_CLOSE_TAGS
+    TAG_CLOSES_P = 4,       // CLOSES_P_TAGS
+    TAG_RAW_TEXT = 8,       // RAW_TEXT_TAGS
+    TAG_BLOCK = 16,         // BLOCK_TAGS, CLOSES_P_TAGS, OPTIONAL_CLOSE_TAGS but for <rt> and <rp>
+    TAG_SCOPE = 32,         // IMPLIED_END_SCOPE_TAGS
+};
+
+struct AtomEntry {
+    string_view text;
+    uint32_t id;        // small and dense: built-in names first, then each document's
+    uint32_t flags = 0; // AtomFlag bits
+};
+
+// Hash of a name from its length and up to three 8-byte words: the first, the
+// last and (past 16 bytes) one from the middle. Names are short, so this sees
+// most of them whole without a per-byte loop.
+constexpr uint64_t atom_word(string_view s, size_t at, size_t n) {
+    uint64_t w = 0;
+    if (is_constant_evaluated()) {
+        for (size_t i = 0; i < n; ++i) {
+            size_t shift = endian::native == endian::little ? i * 8 : (7 - i) * 8;
+            w |= uint64_t(uint8_t(s[at + i])) << shift;
+        }
+    } else {
+        memcpy(&w, s.data() + at, n);
+    }
+    return w;
+}
+
+constexpr uint64_t atom_hash(string_view s) {
+    size_t n = s.size();
+    uint64_t a, b;
+    if (n >= 8) {
+        a = atom_word(s, 0, 8);
+        b = atom_word(s, n - 8, 8);
+        if (n > 16) a ^= atom_word(s, n / 2 - 4, 8) * 0xC2B2AE3D27D4EB4Full;
+    } else if (n >= 4) {
+        a = atom_word(s, 0, 4);
+        b = atom_word(s, n - 4, 4);
+    } else {
+        a = atom_word(s, 0, n);
+        b = 0;
+    }
+    uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ull) ^ n) * 0xFF51AFD7ED558CCDull;
+    return h ^ (h >> 32);
+}
+
+// The built-in names, with an open-addressed table over them laid out at
+// compile time
+template <size_t N>
+class BuiltinAtoms {
+public:
+    static constexpr size_t SLOTS = bit_ceil(2 * N);
+
+    AtomEntry entries[N] = {};
+
+    constexpr BuiltinAtoms(const char* const (&names)[N]) {
+        for (size_t i = 0; i < N; ++i) {
+            string_view name = names[i];
+            if (index_of(name, atom_hash(name)) >= 0) throw "built-in atom listed twice"; // evaluated at compile time: a build error
+            uint32_t flags = (SELF_CLOSING_TAGS.contains(name) ? uint32_t(TAG_VOID) : 0u)
+                | (OPTIONAL_CLOSE_TAGS.contains(name) ? uint32_t(TAG_OPTIONAL_CLOSE) : 0u)
+                | (CLOSES_P_TAGS.contains(name) ? uint32_t(TAG_CLOSES_P) : 0u)
+                | (RAW_TEXT_TAGS.contains(name) ? uint32_t(TAG_RAW_TEXT) : 0u)
+                | (is_block_tag(name) ? uint32_t(TAG_BLOCK) : 0u)
+                | (IMPLIED_END_SCOPE_TAGS.contains(name) ? uint32_t(TAG_SCOPE) : 0u);
+            entries[i] = {name, uint32_t(i), flags};
+            size_t slot = atom_hash(name) & (SLOTS - 1);
+            while (slots[slot]) slot = (slot + 1) & (SLOTS - 1);
+            slots[slot] = uint16_t(i + 1);
+        }
+    }
+
+    // Index of `name` in `entries`, or -1
+    constexpr int index_of(string_view name, uint64_t hash) const {
+        for (size_t slot = hash & (SLOTS - 1); slots[slot]; slot = (slot + 1) & (SLOTS - 1)) {
+            if (entries[slots[slot] - 1].text == name) return slots[slot] - 1;
+        }
+        return -1;
+    }
+
+    const AtomEntry* find(string_view name, uint64_t hash) const {
+        int i = index_of(name, hash);
+        return i < 0 ? nullptr : &entries[i];
+    }
+
+private:
+    uint16_t slots[SLOTS] = {}; // entry index + 1; 0 is empty
+
+    static constexpr bool is_block_tag(string_view name) {
+        bool ruby = name == "rt" || name == "rp";
+        return BLOCK_TAGS.contains(name) || CLOSES_P_TAGS.contains(name) || (OPTIONAL_CLOSE_TAGS.contains(name) && !ruby);
+    }
+};
+
+inline constexpr BuiltinAtoms BUILTIN_ATOMS({
+    "", "ROOT", "xml", "php",
+    // HTML elements
+    "html", "head", "body", "title", "meta", "link", "base", "script", "style", "noscript",
+    "template", "slot", "div", "span", "p", "a", "img", "br", "hr", "wbr", "ul", "ol", "li",
+    "dl", "dt", "dd", "table", "caption", "colgroup", "col", "thead", "tbody", "tfoot", "tr",
+    "td", "th", "form", "input", "button", "select", "option", "optgroup", "textarea", "label",
+    "fieldset", "legend", "datalist", "output", "progress", "meter", "section", "article",
+    "aside", "header", "footer", "nav", "main", "menu", "address", "h1", "h2", "h3", "h4",
+    "h5", "h6", "hgroup", "blockquote", "pre", "code", "em", "strong", "b", "i", "u", "s",
+    "small", "sub", "sup", "mark", "abbr", "cite", "q", "dfn", "kbd", "samp", "var", "time",
+    "data", "ruby", "rt", "rp", "bdi", "bdo", "del", "ins", "figure", "figcaption", "details",
+    "summary", "dialog", "iframe", "embed", "object", "param", "video", "audio", "source",
+    "track", "picture", "canvas", "svg", "path", "area", "map", "math",
+    // HTML attributes
+    "id", "class", "href", "src", "alt", "type", "name", "value", "rel", "lang", "charset",
+    "content", "width", "height", "action", "method", "for", "placeholder", "disabled",
+    "checked", "selected", "target", "role", "tabindex", "colspan", "rowspan", "async",
+    "defer", "crossorigin", "integrity", "media", "sizes", "srcset", "loading", "http-equiv",
+    "xmlns", "onclick", "aria-label", "aria-hidden",
+    // XAML
+    "Window", "Page", "UserControl", "Application", "Grid", "StackPanel", "DockPanel",
+    "WrapPanel", "Canvas", "Border", "Button", "TextBlock", "TextBox", "Label", "Image",
+    "ListBox", "ListView", "ComboBox", "CheckBox", "RadioButton", "ScrollViewer",
+    "ContentControl", "ContentPresenter", "ItemsControl", "DataTemplate", "ControlTemplate",
+    "Style", "Setter", "Trigger", "ResourceDictionary", "RowDefinition", "ColumnDefinition",
+    "Grid.RowDefinitions", "Grid.ColumnDefinitions", "Window.Resources", "UserControl.Resources",
+    "Application.Resources", "x:Class", "x:Name", "x:Key", "xmlns:x", "xmlns:d", "xmlns:mc",
+    "mc:Ignorable", "d:DesignHeight", "d:DesignWidth", "Name", "Text", "Content", "Margin",
+    "Padding", "Width", "Height", "HorizontalAlignment", "VerticalAlignment", "Orientation",
+    "Background", "Foreground", "FontSize", "FontWeight", "FontFamily", "Grid.Row",
+    "Grid.Column", "Grid.RowSpan", "Grid.ColumnSpan", "Visibility", "IsEnabled", "Command",
+    "CommandParameter", "ItemsSource", "SelectedItem", "Source", "Stretch", "ToolTip", "Tag",
+    "TargetType", "Property", "Value", "Template", "DataContext",
+    // Android layouts
+    "LinearLayout", "RelativeLayout", "FrameLayout", "ConstraintLayout",
+    "androidx.constraintlayout.widget.ConstraintLayout", "TextView", "ImageView", "EditText",
+    "RecyclerView", "androidx.recyclerview.widget.RecyclerView", "ScrollView", "View",
+    "include", "merge", "xmlns:android", "xmlns:app", "xmlns:tools", "android:id",
+    "android:layout_width", "android:layout_height", "android:orientation", "android:text",
+    "android:textSize", "android:textColor", "android:padding", "android:layout_margin",
+    "android:layout_marginTop", "android:layout_marginBottom", "android:layout_marginStart",
+    "android:layout_marginEnd", "android:gravity", "android:layout_gravity",
+    "android:layout_weight", "android:background", "android:src", "android:visibility",
+    "android:contentDescription", "app:layout_constraintTop_toTopOf",
+    "app:layout_constraintBottom_toBottomOf", "app:layout_constraintStart_toStartOf",
+    "app:layout_constraintEnd_toEndOf", "tools:context",
+    // FXML
+    "fx:id", "fx:controller", "fx:root", "fx:define", "fx:include", "VBox", "HBox",
+    "BorderPane", "AnchorPane", "GridPane", "Pane", "Scene", "TableView", "TableColumn",
+    "children", "top", "bottom", "left", "right", "center", "spacing", "alignment",
+    "prefWidth", "prefHeight", "onAction", "styleClass", "text",
+});
+
+// Every tag of the tables must be built in, or its atom would not carry the flag
+constexpr bool is_builtin_atom(string_view name) { return BUILTIN_ATOMS.index_of(name, atom_hash(name)) >= 0; }
+static_assert(SELF_CLOSING_TAGS.every(is_builtin_atom) && OPTIONAL_CLOSE_TAGS.every(is_builtin_atom)
+    && CLOSES_P_TAGS.every(is_builtin_atom) && RAW_TEXT_TAGS.every(is_builtin_atom) && BLOCK_TAGS.every(is_builtin_atom)
+    && IMPLIED_END_SCOPE_TAGS.every(is_builtin_atom));
+
+class Atom {
+public:
+    constexpr Atom() : entry(&BUILTIN_ATOMS.entries[0]) {} // the empty name
+    constexpr explicit Atom(const AtomEntry* e) : entry(e) {}
+
+    constexpr string_view text() const { return entry->text; }
+    constexpr uint32_t id() const { return entry->id; }
+    constexpr bool is(AtomFlag flag) const { return (entry->flags & flag) != 0; }
+    constexpr bool empty() const { return entry->text.empty(); }
+
+    friend constexpr bool operator==(Atom a, Atom b) { return a.entry == b.entry; }
+
+private:
+    const AtomEntry* entry;
+};
+
+// A built-in name's atom, looked up at compile time
+consteval Atom builtin_atom(string_view name) {
+    int i = BUILTIN_ATOMS.index_of(name, atom_hash(name));
+    if (i < 0) throw "not a built-in atom";
+    return Atom(&BUILTIN_ATOMS.entries[i]);
+}
+
+inline constexpr Atom ATOM_ROOT = builtin_atom("ROOT");
+inline constexpr Atom ATOM_PHP = builtin_atom("php");
+inline constexpr Atom ATOM_XML = builtin_atom("xml");
+
+// A document's own names: an open-addressed table of entries in its arena
+class AtomTable {
+public:
+    Atom intern(string_view name, pmr::memory_resource* arena) {
+        uint64_t hash = atom_hash(name);
+        if (count * 2 >= slots.size()) grow();
+        size_t mask = slots.size() - 1;
+        size_t slot = hash & mask;
+        for (; slots[slot]; slot = (slot + 1) & mask) {
+            if (slots[slot]->text == name) return Atom(slots[slot]);
+        }
+
+        // First use in this document: a built-in name, or a new one
+        const AtomEntry* e = BUILTIN_ATOMS.find(name, hash);
+        if (!e) {
+            char* text = static_cast<char*>(arena->allocate(name.size(), 1));
+            memcpy(text, name.data(), name.size());
+            void* mem = arena->allocate(sizeof(AtomEntry), alignof(AtomEntry));
+            e = new (mem) AtomEntry{string_view(text, name.size()), uint32_t(size(BUILTIN_ATOMS.entries) + added++)};
+        }
+        slots[slot] = e;
+        count++;
+        return Atom(e);
+    }
+
+    // The names that are not built in, in the order they were added
+    vector<const AtomEntry*> added_entries() const {
+        vector<const AtomEntry*> out;
+        for (const AtomEntry* e : slots) {
+            if (e && e->id >= size(BUILTIN_ATOMS.entries)) out.push_back(e);
+        }
+        sort(out.begin(), out.end(), [](const AtomEntry* a, const AtomEntry* b) { return a->id < b->id; });
+        return out;
+    }
+
+private:
+    vector<const AtomEntry*> slots;
+    size_t count = 0; // names in the table
+    size_t added = 0; // names that are not built in
+
+    void grow() {
+        vector<const AtomEntry*> old = std::move(slots);
+        slots.assign(max<size_t>(64, old.size() * 2), nullptr);
+        size_t mask = slots.size() - 1;
+        for (const AtomEntry* e : old) {
+            if (!e) continue;
+            size_t slot = atom_hash(e->text) & mask;
+            while (slots[slot]) slot = (slot + 1) & mask;
+            slots[slot] = e;
+        }
+    }
+};
+
+// ======================
+// AST Structure
+// ======================
+struct Attribute {
+    Atom key;
+    StrRef value;
+    StrRef separator; // e.g., " ", ", ", "\n "
+};
+
+enum NodeType {
+    ELEMENT,
+    TEXT,
+    COMMENT,
+    COMMENT_BLOCK,
+    PI, // Processing Instruction
+    IMPORT, // Special for FXML imports
+    WHITESPACE
+};
+
+// Nodes live in their Document's arena and are never deleted one by one.
+struct Node {
+    NodeType type;
+    Atom tag; // Element tag name; "php" or "xml" for a PI
+    pmr::vector<Attribute> attrs;
+    StrRef content; // Text, Comment content, PI content
+    pmr::vector<Node*> children;
+    bool explicit_empty_block = false; // true if {} was explicitly present but empty
+
+    // Where the node came from: [begin, end) is the whole node in the source text,
+    // [body_begin, body_end) the content between an element's braces or tags
+    // (body_begin stays 0 when there is none)
+    size_t begin = 0;
+    size_t end = 0;
+    size_t body_begin = 0;
+    size_t body_end = 0;
+
+    Node(NodeType t, pmr::memory_resource* mr) : type(t), attrs(mr), children(mr) {}
+
+    void add_child(Node* child) {
+        children.push_back(child);
+    }
+};
+
+// ======================
+// Source Buffers
+// ======================
+// The text a Document was parsed from: an owned string, or a read-only mapping
+// of the input file (see files.h). Node strings are views into it.
+class SourceBuffer {
+public:
+    virtual ~SourceBuffer() {}
+    virtual string_view text() const = 0;
+};
+
+class StringSource : public SourceBuffer {
+public:
+    explicit StringSource(string&& s) : str(std::move(s)) {}
+    string_view text() const override { return str; }
+
+private:
+    string str;
+};
+
+// Text owned by the caller, who keeps it alive for as long as the document
+class ViewSource : public SourceBuffer {
+public:
+    explicit ViewSource(string_view s) : str(s) {}
+    string_view text() const override { return str; }
+
+private:
+    string_view str;
+};
+
+// Upstream of a document's arena: takes its chunks from the heap and counts them
+class CountingResource : public pmr::memory_resource {
+public:
+    size_t bytes = 0;
+    size_t allocations = 0;
+
+private:
+    void* do_allocate(size_t n, size_t align) override {
+        bytes += n;
+        allocations++;
+        return pmr::new_delete_resource()->allocate(n, align);
+    }
+    void do_deallocate(void* p, size_t n, size_t align) override {
+        pmr::new_delete_resource()->deallocate(p, n, align);
+    }
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// ======================
+// Document
+// ======================
+// Owns a parsed tree and the text it was parsed from. Node strings are views into
+// that source; nodes, their attribute and child arrays and any text that had to be
+// created rather than sliced are bump-allocated from one arena, which is released
+// in one shot when the document goes away.
+class Document {
+public:
+    Node* root = nullptr;
+
+    explicit Document(size_t size_hint = 0)
+        : arena(make_unique<Arena>(clamp<size_t>(size_hint, 4096, 1 << 24))) {}
+
+    // Take ownership of the text to be parsed. It is held on the heap so views
+    // into it survive moving the document.
+    string_view set_source(unique_ptr<SourceBuffer> src) {
+        source_buf = std::move(src);
+        return source();
+    }
+
+    string_view source() const {
+        return source_buf ? source_buf->text() : string_view();
+    }
+
+    Node* make_node(NodeType t) {
+        void* mem = arena->pool.allocate(sizeof(Node), alignof(Node));
+        return new (mem) Node(t, &arena->pool);
+    }
+
+    // The atom for a tag or attribute name
+    Atom intern(string_view name) {
+        return atoms.intern(name, &arena->pool);
+    }
+
+    // Copy text into the arena
+    StrRef store(string_view s) {
+        if (s.empty()) return {};
+        char* p = static_cast<char*>(arena->pool.allocate(s.size(), 1));
+        memcpy(p, s.data(), s.size());
+        return StrRef(p, s.size());
+    }
+
+    // Names interned here that are not built in, in the order they were added
+    vector<const AtomEntry*> added_atoms() const {
+        return atoms.added_entries();
+    }
+
+    // Take over the arena of `part`, a document whose nodes are being moved
+    // into this one. Its atoms stay behind: names that are not built in must be
+    // interned here again.
+    void adopt(Document&& part) {
+        parts.push_back(std::move(part.arena));
+    }
+
+    // What the arenas have taken from the heap so far
+    size_t arena_bytes() const {
+        size_t n = arena->heap.bytes;
+        for (const auto& a : parts) n += a->heap.bytes;
+        return n;
+    }
+    size_t arena_allocations() const {
+        size_t n = arena->heap.allocations;
+        for (const auto& a : parts) n += a->heap.allocations;
+        return n;
+    }
+
+private:
+    // The arena and the heap it takes chunks from, which must outlive it
+    struct Arena {
+        CountingResource heap;
+        pmr::monotonic_buffer_resource pool;
+
+        explicit Arena(size_t initial_size) : pool(initial_size, &heap) {}
+    };
+
+    unique_ptr<Arena> arena;
+    vector<unique_ptr<Arena>> parts; // adopted from documents parsed alongside this one
+    unique_ptr<SourceBuffer> source_buf;
+    AtomTable atoms;
+};
+
+// ======================
+// Parallel Loop
+// ======================
+// Call fn(i) for every i in [0, count) on up to `threads` threads, the calling
+// one included, and wait for all of them. Items are handed out in order from a
+// shared counter, so one slow item does not hold up the rest.
+template <class F>
+void parallel_for(size_t count, unsigned threads, const F& fn) {
+    atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i; (i = next++) < count;) fn(i);
+    };
+    vector<thread> pool;
+    for (size_t t = 1; t < min<size_t>(threads, count); ++t) pool.emplace_back(work);
+    work();
+    for (auto& t : pool) t.join();
+}
+
+// ======================
+// Formatter Interface
+// ======================
+class Formatter {
+public:
+    // Threads for a tree parsed from PARALLEL_MIN source bytes or more. Runs of
+    // sibling subtrees are written into buffers of their own concurrently and
+    // joined in document order; the output is the same as on one thread.
+    unsigned threads = 1;
+    static constexpr size_t PARALLEL_MIN = size_t(1) << 20;
+    static constexpr size_t PARALLEL_CHUNK_MIN = size_t(1) << 16;
+
+    // Write `node` straight into `out` in one pass
+    virtual void format(Node* node, Sink& out, int indent_level = 0) = 0;
+    virtual ~Formatter() {}
+
+    string format(Node* node, int indent_level = 0) {
+        StringSink out;
+        format(node, out, indent_level);
+        return out.take();
+    }
+
+protected:
+    // Write `node` with f (see walk), on more than one thread when it is big
+    // enough. f.open and f.close must only read the formatter.
+    template <class F>
+    void write_tree(F& f, Node* node, Sink& out, int indent_level) {
+        if (threads > 1 && node && source_span(node) >= PARALLEL_MIN) {
+            walk_parallel(f, node, out, indent_level);
+        } else {
+            walk(f, &node, &node + 1, out, indent_level);
+        }
+    }
+
+    // Depth-first walk over the nodes in [first, last), written at
+    // `indent_level`, on an explicit stack so nesting depth costs heap rather
+    // than native stack. f.open(n, out, indent) writes a node - or, if it returns
+    // true, just what comes before its children - and f.close(n, out, indent)
+    // what comes after them.
+    template <class F>
+    static void walk(F& f, Node* const* first, Node* const* last, Sink& out, int indent_level) {
+        struct Frame {
+            Node* el;               // null for the bottom frame, which holds [first, last)
+            Node* const* next;      // next child to write
+            Node* const* last;
+            int indent;             // the element's own level
+            int inner;              // its children's level; the root's children sit at its own
+        };
+        if (first == last || !*first) return;
+        vector<Frame> open;
+        open.push_back({nullptr, first, last, indent_level, indent_level});
+        while (!open.empty()) {
+            // Write leaf children in a tight loop until one has children of its own
+            Frame& top = open.back();
+            Node* const* child = top.next;
+            Node* const* last = top.last;
+            int inner = top.inner;
+            while (child != last && !f.open(*child, out, inner)) ++child;
+            if (child == last) {
+                if (top.el) f.close(top.el, out, top.indent);
+                open.pop_back();
+                continue;
+            }
+            top.next = child + 1;
+            Node* el = *child;
+            const auto& kids = el->children;
+            open.push_back({el, kids.data(), kids.data() + kids.size(), inner, inner_indent(el, inner)});
+        }
+    }
+
+    // The level children of `el` are written at when it sits at `indent_level`
+    static int inner_indent(Node* el, int indent_level) {
+        return el->tag == ATOM_ROOT ? indent_level : indent_level + 1;
+    }
+
+    static size_t source_span(Node* node) {
+        return node->end > node->begin ? node->end - node->begin : 0;
+    }
+
+    // Split the children of one element - the top node, or while one child
+    // holds most of the source, that child's - into runs of about equal source
+    // size. The runs are written concurrently, each into its own buffer, then
+    // the elements on the way down are opened, the buffers copied out in order
+    // and the elements closed again, with their other children in between.
+    template <class F>
+    void walk_parallel(F& f, Node* node, Sink& out, int indent_level) {
+        struct Level {
+            Node* el;
+            int indent;
+            size_t down; // index of the child on the way down
+        };
+        vector<Level> spine{{node, indent_level, 0}};
+        for (int depth = 0; depth < 8; ++depth) {
+            Level& top = spine.back();
+            const auto& kids = top.el->children;
+            size_t biggest = 0;
+            for (size_t i = 1; i < kids.size(); ++i) {
+                if (source_span(kids[i]) > source_span(kids[biggest])) biggest = i;
+            }
+            if (kids.size() != 1 && (kids.empty() || source_span(kids[biggest]) * 2 <= source_span(top.el))) break;
+            if (kids[biggest]->type != ELEMENT || kids[biggest]->children.empty()) break;
+            top.down = biggest;
+            spine.push_back({kids[biggest], inner_indent(top.el, top.indent), 0});
+        }
+
+        struct Run {
+            Node* const* first;
+            Node* const* last;
+        };
+        Node* parent = spine.back().el;
+        int inner = inner_indent(parent, spine.back().indent);
+        const auto& kids = parent->children;
+        size_t target = max(PARALLEL_CHUNK_MIN, source_span(parent) / (size_t(threads) * 8));
+        vector<Run> runs;
+        size_t run_size = 0;
+        for (size_t i = 0; i < kids.size(); ++i) {
+            if (runs.empty() || run_size >= target) {
+                runs.push_back({kids.data() + i, kids.data() + i});
+                run_size = 0;
+            }
+            runs.back().last++;
+            run_size += source_span(kids[i]);
+        }
+        if (runs.size() < 2) {
+            walk(f, &node, &node + 1, out, indent_level);
+            return;
+        }
+        vector<StringSink> written(runs.size());
+        parallel_for(runs.size(), threads, [&](size_t i) { walk(f, runs[i].first, runs[i].last, written[i], inner); });
+
+        // Open the spine down to `parent`. An element that doesn't open (one
+        // written whole, on a line of its own) ends the descent.
+        size_t opened = 0;
+        for (; opened < spine.size(); ++opened) {
+            Level& level = spine[opened];
+            if (!f.open(level.el, out, level.indent)) break;
+            if (opened + 1 == spine.size()) {
+                for (const auto& w : written) out.write(w.view());
+            } else {
+                Node* const* kid = level.el->children.data();
+                walk(f, kid, kid + level.down, out, inner_indent(level.el, level.indent));
+            }
+        }
+        while (opened-- > 0) {
+            Level& level = spine[opened];
+            if (opened + 1 < spine.size()) {
+                const auto& after = level.el->children;
+                walk(f, after.data() + level.down + 1, after.data() + after.size(), out, inner_indent(level.el, level.indent));
+            }
+            f.close(level.el, out, level.indent);
+        }
+    }
+
+    void write_indent(Sink& out, int level) {
+        // Precomputed run of spaces; deeper levels take it more than once
+        static const string spaces(256, ' ');
+        size_t n = size_t(level) * 4;
+        while (n > spaces.size()) {
+            out.write(spaces);
+            n -= spaces.size();
+        }
+        out.write(string_view(spaces).substr(0, n));
+    }
+
+    // Replicate the blank lines of a WHITESPACE node
+    void write_blank_lines(Node* node, Sink& out) {
+        size_t n = std::count(node->content.begin(), node->content.end(), '\n');
+        if (n > 1) out.fill('\n', n - 1);
+    }
+    
+    void format_attrs(const pmr::vector<Attribute>& attrs, Sink& out) {
+        for (const auto& attr : attrs) {
+            // The separator stored includes the leading whitespace
+            out.write(attr.separator.empty() ? " " : attr.separator);
+            out.write(attr.key.text());
+            out.write("=\"");
+            out.write(attr.value);
+            out.put('"');
+        }
+    }
+};
+
+// ======================
+// EML Formatter
+// ======================
+class EmlFormatter : public Formatter {
+public:
+    using Formatter::format;
+
+    void format(Node* node, Sink& out, int indent_level = 0) override {
+        write_tree(*this, node, out, indent_level);
+    }
+
+private:
+    friend class Formatter;
+    friend class StreamDecompiler; // writes nodes one at a time as they are read
+
+    // Write `node`, or just its opening if its children follow (see walk)
+    bool open(Node* node, Sink& out, int indent_level) {
+        if (node->type == WHITESPACE) {
+             // Replicate newlines
+             write_blank_lines(node, out);
+             return false;
+        }
+
+        if (node->type == COMMENT) {
+            write_indent(out, indent_level);
+            out.write("// ");
+            out.write(node->content);
+            out.put('\n');
+            return false;
+        }
+        if (node->type == COMMENT_BLOCK) {
+            write_indent(out, indent_level);
+            out.write("/*");
+            out.write(node->content);
+            out.write("*/\n");
+            return false;
+        }
+        if (node->type == IMPORT) {
+            out.write("import ");
+            out.write(node->content);
+            out.write(";\n");
+            return false;
+        }
+        if (node->type == PI) {
+            write_indent(out, indent_level);
+            if (node->tag == ATOM_PHP) {
+                out.write("php {\n");
+                format_children_raw(node, out, indent_level + 1);
+                write_indent(out, indent_level);
+                out.write("}\n");
+                return false;
+            }
+            // Other PIs or unexpected ones
+            out.write("php /* ");
+            out.write(node->content);
+            out.write(" */\n");
+            return false;
+        }
+
+        if (node->type == TEXT) {
+             // Text in EML is usually inline or wrapped in {} if implicitly part of a parent
+             // But here we are formatting a node. 
+             // Pure text nodes at top level shouldn't happen in valid EML usually, unless inside an element.
+             write_indent(out, indent_level);
+             out.write(node->content);
+             out.put('\n');
+             return false;
+        }
+
+        if (node->type == ELEMENT) {
+            if (node->tag == ATOM_ROOT) return true;
+
+            write_indent(out, indent_level);
+            out.write(node->tag.text());
+            
+            // Attributes
+            if (!node->attrs.empty()) {
+                out.write(" (");
+                bool first = true;
+                for (const auto& attr : node->attrs) {
+                    if (!first) out.write(", ");
+                    out.write(attr.key.text());
+                    out.write(" = \"");
+                    out.write(attr.value);
+                    out.put('"');
+                    first = false;
+                }
+                out.put(')');
+            }
+
+            if (node->children.empty()) {
+                if (node->explicit_empty_block) {
+                    out.write(" {}\n");
+                } else {
+                    out.put('\n');
+                }
+            } else {
+                // Check if single text child (inline)
+                if (node->children.size() == 1 && node->children[0]->type == TEXT) {
+                    string_view text = trim(node->children[0]->content);
+                    if (text.find('\n') == string::npos) {
+                        out.write(" { ");
+                        out.write(text);
+                        out.write(" }\n");
+                        return false;
+                    }
+                }
+
+                out.write(" {\n");
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void close(Node* node, Sink& out, int indent_level) {
+        if (node->tag == ATOM_ROOT) return;
+        write_indent(out, indent_level);
+        out.write("}\n");
+    }
+
+    void format_children_raw(Node* node, Sink& out, int indent_level) {
+        // For raw blocks like php, we just want content lines indented
+        string_view content = node->content;
+        size_t start = 0;
+        while (start < content.size()) {
+            size_t nl = content.find('\n', start);
+            if (nl == string::npos) nl = content.size();
+            write_indent(out, indent_level);
+            out.write(trim(content.substr(start, nl - start)));
+            out.put('\n');
+            start = nl + 1;
+        }
+    }
+};
+
+// ======================
+// HTML/XML Formatter
+// ======================
+class MarkupFormatter : public Formatter {
+    bool is_xml; // true: XAML/XML (strict), false: HTML/PHP (loose, void tags)
+
+public:
+    // Write everything on one line, with no indentation and only the whitespace
+    // that could show; in HTML, leave out optional end tags and the quotes of
+    // attribute values that need none. The bodies of raw text elements (pre,
+    // script, style, code, textarea) and of PHP blocks are written as they are.
+    bool minify = false;
+
+    MarkupFormatter(bool xml_mode) : is_xml(xml_mode) {}
+
+    using Formatter::format;
+
+    void format(Node* node, Sink& out, int indent_level = 0) override {
+        if (!minify) {
+            write_tree(*this, node, out, indent_level);
+            return;
+        }
+        // What was written last decides what comes next, so this stays on one thread
+        last = TOKEN_NONE;
+        last_inline = false;
+        pending_end = nullptr;
+        raw_depth = 0;
+        walk(*this, &node, &node + 1, out, indent_level);
+        if (pending_end) write_end_tag(pending_end, out);
+    }
+
+private:
+    friend class Formatter;
+
+    static constexpr Atom ATOM_TEXTAREA = builtin_atom("textarea");
+
+    // Minified output: the kind of the last tag or text written, and an end
+    // tag held back until what follows shows whether HTML lets it be left out
+    enum Token { TOKEN_NONE, TOKEN_OPEN, TOKEN_CLOSE, TOKEN_TEXT };
+    Token last = TOKEN_NONE;
+    bool last_inline = false;
+    Node* pending_end = nullptr;
+    int raw_depth = 0; // open elements whose content is written as it is
+
+    // Write `node`, or just its opening if its children follow (see walk)
+    bool open(Node* node, Sink& out, int indent_level) {
+        if (minify) return open_minified(node, out);
+        if (node->type == WHITESPACE) {
+             write_blank_lines(node, out);
+             return false;
+        }
+
+        if (node->type == COMMENT) {
+            // Multi-line comment fidelity: just wrap in <!-- --> without flattening.
+            write_indent(out, indent_level);
+            out.write("<!-- ");
+            out.write(trim(node->content));
+            out.write(" -->\n");
+            return false;
+        }
+        if (node->type == COMMENT_BLOCK) {
+            // /* ... */ style (block)
+            // Preserve raw content?
+            write_indent(out, indent_level);
+            out.write("<!--");
+            out.write(node->content);
+            out.write("-->\n");
+            return false;
+        }
+        if (node->type == IMPORT) {
+            write_indent(out, indent_level);
+            out.write("<?import ");
+            out.write(node->content);
+            out.write("?>\n");
+            return false;
+        }
+        if (node->type == PI) {
+            write_indent(out, indent_level);
+            if (node->tag == ATOM_PHP) {
+                // Do NOT trim content to preserve indentation
+                string_view php_content = node->content;
+                
+                // Generally users want:
+                // <?php
+                //     code...
+                // ?>
+                // Content includes leading newline if present (EML: php { ... }),
+                // so output exactly what was captured and only make sure the
+                // opening and closing tags sit on their own lines.
+                bool starts_newline = !php_content.empty() && php_content[0] == '\n';
+                out.write("<?php");
+                if (!starts_newline) out.put('\n');
+                out.write(php_content);
+                if (!php_content.empty() && php_content.back() != '\n') out.put('\n');
+                write_indent(out, indent_level);
+                out.write("?>\n");
+                return false;
+            }
+            out.write("<?");
+            out.write(node->tag.text());
+            out.put(' ');
+            out.write(node->content);
+            out.write("?>\n");
+            return false;
+        }
+
+        if (node->type == TEXT) {
+            // If it's pure whitespace content, we might want to respect it?
+            // trimming usually safest for pretty print
+            write_indent(out, indent_level);
+            out.write(trim(node->content));
+            out.put('\n');
+            return false;
+        }
+
+        if (node->type == ELEMENT) {
+            if (node->tag == ATOM_ROOT) return true;
+
+            // Self-closing check
+            bool self_close = false;
+            if (is_xml) {
+                // In XML/XAML, if empty AND not explicitly forced to have block (although optimization usually valid),
+                // User requirement: "try to turn non self closing to self closing" -> No, user complaint was OPPOSITE.
+                // User complaint: "turns a non self closing tag to a self closing".
+                // So we should ONLY self-close if logic demands it, OR if it's strictly empty and allowed.
+                // FIX: If it has children, never self close. If no children:
+                // If it was explicit empty block in EML `Tag {}`, we shouldn't self close? 
+                // But AST doesn't know origin if converted from XML.
+                // Let's rely on children.empty(). 
+                // AND checking if the user INTENDED an empty block.
+                // We added `explicit_empty_block`.
+                if (node->children.empty() && !node->explicit_empty_block) {
+                    self_close = true;
+                }
+            } else {
+                // HTML: Only void tags are self-closing (void elements)
+                if (node->tag.is(TAG_VOID)) {
+                    self_close = true; // Output <br> or <br /> depending on style?
+                }
+            }
+            
+            // Override: If strict XML, explicit empty block means <T></T>.
+            if (is_xml && node->explicit_empty_block) self_close = false;
+            // Override: If HTML, explicit empty block `div {}` -> <div></div>. Correct.
+
+            write_indent(out, indent_level);
+            out.put('<');
+            out.write(node->tag.text());
+            for (const auto& attr : node->attrs) {
+                // For simplified formatter, just use space as the separator
+                out.put(' ');
+                out.write(attr.key.text());
+                out.write("=\"");
+                out.write(attr.value);
+                out.put('"');
+            }
+            
+            if (self_close) {
+                 if (is_xml) out.write(" />\n");
+                 else out.write(">\n"); // HTML void tags usually don't have />
+                 return false;
+            }
+
+            out.put('>');
+                
+            // Content
+            if (node->children.empty()) {
+                write_close_tag(node, out);
+                return false;
+            }
+
+            // Optimized single text line
+            if (node->children.size() == 1 && node->children[0]->type == TEXT) {
+                string_view t = node->children[0]->content;
+
+                // Try to inline if no newlines and not empty
+                // Use untrimmed 't' to preserve internal spaces if user provided them `h1 { Hello }`
+                if (t.find('\n') == string::npos && !trim(t).empty()) {
+                    out.write(t);
+                    write_close_tag(node, out);
+                    return false;
+                }
+                
+                // Multi-line or whitespace-only preservation
+                
+                // Trim trailing horizontal whitespace (indentation of the closing brace in EML)
+                // to prevent extra blank line/indent before output closing tag
+                size_t last_char = t.find_last_not_of(" \t");
+                t = (last_char != string::npos) ? t.substr(0, last_char + 1) : t.substr(0, 0);
+
+                // If content doesn't start with newline, add one for block separation
+                bool starts_newline = !t.empty() && t[0] == '\n';
+                if (!starts_newline) out.put('\n');
+                
+                out.write(t);
+                
+                // Ensure closing tag starts on a new line
+                if (!t.empty() && t.back() != '\n') out.put('\n');
+                
+                write_indent(out, indent_level);
+                write_close_tag(node, out);
+                return false;
+            }
+
+            // Fallback for multiple/mixed children, written by walk
+            out.put('\n');
+            return true;
+        }
+        return false;
+    }
+
+    void close(Node* node, Sink& out, int indent_level) {
+        if (node->tag == ATOM_ROOT) return;
+        if (minify) {
+            begin_token(out, TOKEN_CLOSE, is_inline(node), node);
+            end_element(node, out);
+            if (is_raw(node)) raw_depth--;
+            return;
+        }
+        write_indent(out, indent_level);
+        write_close_tag(node, out);
+    }
+
+    void write_close_tag(Node* node, Sink& out) {
+        write_end_tag(node, out);
+        out.put('\n');
+    }
+
+    void write_end_tag(Node* node, Sink& out) {
+        out.write("</");
+        out.write(node->tag.text());
+        out.put('>');
+    }
+
+    // The minified form of open(). Whitespace goes only where the pretty form
+    // breaks the line, and only where it could show: in HTML between two
+    // inline tags or text, in XML next to text that is not the first or last
+    // thing in its element.
+    bool open_minified(Node* node, Sink& out) {
+        switch (node->type) {
+            case WHITESPACE:
+                if (raw_depth) out.write(node->content);
+                return false;
+            case TEXT: {
+                string_view text = raw_depth ? node->content : trim(node->content);
+                if (text.empty()) return false;
+                begin_token(out, TOKEN_TEXT, true, nullptr);
+                write_text(text, out);
+                return false;
+            }
+            case COMMENT: {
+                begin_token(out, TOKEN_OPEN, true, nullptr);
+                // Keep the spaces where the text would otherwise run into "<!--" or "-->"
+                string_view text = trim(node->content);
+                bool pad = !text.empty() && (text.front() == '>' || text.front() == '-' || text.back() == '-');
+                out.write(pad ? "<!-- " : "<!--");
+                out.write(text);
+                out.write(pad ? " -->" : "-->");
+                last = TOKEN_CLOSE;
+                return false;
+            }
+            case COMMENT_BLOCK:
+                begin_token(out, TOKEN_OPEN, true, nullptr);
+                out.write("<!--");
+                out.write(node->content);
+                out.write("-->");
+                last = TOKEN_CLOSE;
+                return false;
+            case IMPORT:
+                begin_token(out, TOKEN_OPEN, true, nullptr);
+                out.write("<?import ");
+                out.write(node->content);
+                out.write("?>");
+                last = TOKEN_CLOSE;
+                return false;
+            case PI:
+                begin_token(out, TOKEN_OPEN, true, nullptr);
+                out.write("<?");
+                out.write(node->tag.text());
+                // The body as it is; "<?php" must still be followed by whitespace
+                if (node->tag != ATOM_PHP || node->content.empty() || !is_space_byte(node->content[0])) out.put(' ');
+                out.write(node->content);
+                out.write("?>");
+                last = TOKEN_CLOSE;
+                return false;
+            case ELEMENT:
+                break;
+        }
+        if (node->tag == ATOM_ROOT) return true;
+
+        begin_token(out, TOKEN_OPEN, is_inline(node), node);
+        out.put('<');
+        out.write(node->tag.text());
+        for (const auto& attr : node->attrs) {
+            out.put(' ');
+            out.write(attr.key.text());
+            if (!is_xml && attr.value.empty()) continue; // an empty value needs no "=\"\""
+            if (!is_xml && is_bare_value(attr.value)) {
+                out.put('=');
+                out.write(attr.value);
+                continue;
+            }
+            out.write("=\"");
+            out.write(attr.value);
+            out.put('"');
+        }
+
+        bool self_close = is_xml ? node->children.empty() && !node->explicit_empty_block : node->tag.is(TAG_VOID);
+        if (self_close) {
+            out.write(is_xml ? "/>" : ">");
+            last = TOKEN_CLOSE;
+            return false;
+        }
+        out.put('>');
+        if (node->children.empty()) {
+            end_element(node, out);
+            return false;
+        }
+
+        // One line of text stays between the tags, as in the pretty form
+        bool raw = is_raw(node);
+        Node* only = node->children.size() == 1 ? node->children[0] : nullptr;
+        if (only && only->type == TEXT && (raw || raw_depth || (only->content.find('\n') == string::npos && !trim(only->content).empty()))) {
+            raw_depth += raw;
+            write_text(only->content, out);
+            raw_depth -= raw;
+            end_element(node, out);
+            return false;
+        }
+        raw_depth += raw;
+        return true;
+    }
+
+    // Text as it is in a raw element or in XML; HTML collapses runs of whitespace
+    void write_text(string_view text, Sink& out) {
+        if (raw_depth || is_xml) {
+            out.write(text);
+            return;
+        }
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t space = scan<SpaceStart>(text, start);
+            out.write(text.substr(start, space - start));
+            if (space == text.size()) break;
+            out.put(' ');
+            start = scan<SpaceEnd>(text, space);
+        }
+    }
+
+    // Write the separator `kind` needs after what was written last, first
+    // settling a held-back end tag: HTML drops it before a start tag that would
+    // end the element anyway, and before its parent's end tag where allowed
+    void begin_token(Sink& out, Token kind, bool inline_token, Node* el) {
+        if (pending_end) {
+            bool omit = (kind == TOKEN_OPEN && el && implies_end_tag(pending_end->tag.text(), el->tag.text())) ||
+                        (kind == TOKEN_CLOSE && el && may_end_with_parent(pending_end, el));
+            if (!omit) write_end_tag(pending_end, out);
+            pending_end = nullptr;
+        }
+        if (raw_depth == 0) {
+            bool space = is_xml ? (last == TOKEN_TEXT && kind != TOKEN_CLOSE) || (kind == TOKEN_TEXT && last == TOKEN_CLOSE)
+                                : last_inline && inline_token;
+            if (space) out.put(' ');
+        }
+        last = kind;
+        last_inline = inline_token;
+    }
+
+    // An element's end tag, or in HTML, the promise of one (see begin_token)
+    void end_element(Node* node, Sink& out) {
+        if (!is_xml && raw_depth == 0 && node->tag.is(TAG_OPTIONAL_CLOSE)) pending_end = node;
+        else write_end_tag(node, out);
+        last = TOKEN_CLOSE;
+    }
+
+    // Whether `child`, the last in `parent`, may end without an end tag. Only
+    // in the parent HTML puts it in, which is then sure to still be open when
+    // its own end tag comes. <dt> and <thead> may only end before a sibling.
+    static bool may_end_with_parent(Node* child, Node* parent) {
+        string_view tag = child->tag.text();
+        string_view outer = parent->tag.text();
+        if (tag == "p") return !P_END_REQUIRED_IN.contains(outer) && outer.find('-') == string_view::npos; // nor in custom elements
+        if (tag == "li") return outer == "ul" || outer == "ol" || outer == "menu";
+        if (tag == "dd") return outer == "dl" || outer == "div";
+        if (tag == "td" || tag == "th") return outer == "tr";
+        if (tag == "tr") return outer == "tbody" || outer == "thead" || outer == "tfoot" || outer == "table";
+        if (tag == "tbody" || tag == "tfoot") return outer == "table";
+        if (tag == "option") return outer == "select" || outer == "datalist" || outer == "optgroup";
+        if (tag == "optgroup") return outer == "select";
+        if (tag == "rt" || tag == "rp") return outer == "ruby";
+        return false;
+    }
+
+    bool is_inline(Node* node) const {
+        return !is_xml && !node->tag.is(TAG_BLOCK);
+    }
+
+    static bool is_raw(Node* node) {
+        return node->tag.is(TAG_RAW_TEXT) || node->tag == ATOM_TEXTAREA;
+    }
+
+    // An HTML attribute value that can be written without quotes, and read
+    // back the same by this parser as well
+    static bool is_bare_value(string_view value) {
+        for (char c : value) {
+            if (is_space_byte(c) || c == '"' || c == '\'' || c == '=' || c == '<' || c == '>' || c == '`' || c == '/') return false;
+        }
+        return true;
+    }
+};
+
+// ======================
+// EML Block Index
+// ======================
+// One forward scan over an EML input that pairs every '{' with the '}' closing it
+// and classifies each block as text (`div { Some Text }`) or nested markup
+// (`div { span {} }`). Braces are counted naively, the way blocks have always been
+// read, so a block's span depends only on the text after its '{'.
+//
+// A block holds markup when it contains an identifier followed by optional
+// whitespace and '(' or '{' - the same test as the old per-block
+// \b[a-zA-Z_][a-zA-Z0-9_.-]*\s*[({] regex probe. A match inside a nested block
+// also counts for every block around it.
+class BlockIndex {
+public:
+    struct Span {
+        size_t open;
+        size_t close; // string::npos if the block runs to the end of input
+        bool markup;
+        uint32_t depth; // blocks around this one
+    };
+
+    void build(string_view input) {
+        scan(input, 0, false);
+    }
+
+    // Index only the block opened at `open` and the blocks inside it
+    void build_block(string_view input, size_t open) {
+        scan(input, open, true);
+    }
+
+    // Whether an element header - tag, optional attributes and the '{' at
+    // `open` - marks the block around it as markup by itself, wherever it sits.
+    // Conservative: the header must start a fresh identifier run and hold no
+    // braces of its own.
+    static bool header_marks_parent(string_view input, size_t begin, size_t open) {
+        if (begin > 0 && is_run_char(input[begin - 1])) return false;
+        Scanner sc;
+        bool marked = false;
+        for (size_t i = begin; i <= open && i < input.size(); ++i) {
+            char c = input[i];
+            if (i < open && (c == '{' || c == '}')) return false;
+            if (sc.step(c)) marked = true;
+        }
+        return marked;
+    }
+
+    // Span of the block opened at `open`. A parser visits blocks in input order,
+    // so its lookups only ever move forward from `cursor`, which starts at 0 and
+    // is kept by the caller: parsers on several threads can share one index.
+    const Span* find(size_t open, size_t& cursor) const {
+        auto it = lower_bound(spans.begin() + cursor, spans.end(), open,
+            [](const Span& b, size_t p) { return b.open < p; });
+        cursor = it - spans.begin();
+        if (it == spans.end() || it->open != open) return nullptr;
+        return &*it;
+    }
+
+    const vector<Span>& all() const { return spans; }
+
+private:
+    vector<Span> spans;
+
+    static bool is_run_char(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '-';
+    }
+
+    // Classifier state carried along the scan
+    struct Scanner {
+        bool in_ident = false; // previous char continues an [A-Za-z0-9_.-] run
+        bool tag_ready = false; // that run (plus trailing whitespace) can start a tag
+        char prev = 0;
+
+        // Feed one char. True for a '(' or '{' closing a tag-like run, which
+        // marks the innermost open block as markup.
+        bool step(char c) {
+            bool marks = false;
+            bool word_start = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+            if (word_start || (c >= '0' && c <= '9') || c == '.' || c == '-') {
+                // A tag can start at the beginning of a run or right after '.'/'-' (a \b inside the run)
+                if (!in_ident) tag_ready = word_start;
+                else if (word_start && (prev == '.' || prev == '-')) tag_ready = true;
+                in_ident = true;
+            } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') {
+                in_ident = false;
+            } else {
+                marks = (c == '(' || c == '{') && tag_ready;
+                in_ident = false;
+                tag_ready = false;
+            }
+            prev = c;
+            return marks;
+        }
+    };
+
+    // Whether the '(' or '{' at `i` closes a tag-like run: what Scanner::step
+    // would say after feeding it [first, i], worked out backwards from `i`.
+    // The last identifier run before it - whitespace may come between - must
+    // start with a letter or '_', or have one right after a '.' or '-'.
+    static bool closes_tag_run(string_view input, size_t first, size_t i) {
+        size_t end = i;
+        while (end > first && is_space_byte(input[end - 1])) --end;
+        size_t begin = end;
+        while (begin > first && is_run_char(input[begin - 1])) --begin;
+        if (begin == end) return false;
+        auto word_start = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+        if (word_start(input[begin])) return true;
+        for (size_t k = begin + 1; k < end; ++k) {
+            if (word_start(input[k]) && (input[k - 1] == '.' || input[k - 1] == '-')) return true;
+        }
+        return false;
+    }
+
+    // Only braces and '(' matter, so the scan jumps from one to the next
+    void scan(string_view input, size_t first, bool one_block) {
+        spans.clear();
+        vector<size_t> open;
+
+        for (size_t i = ::scan<BlockEvent>(input, first); i < input.size(); i = ::scan<BlockEvent>(input, i + 1)) {
+            char c = input[i];
+            if (c != '}' && !open.empty() && !spans[open.back()].markup && closes_tag_run(input, first, i)) {
+                spans[open.back()].markup = true;
+            }
+
+            if (c == '{') {
+                open.push_back(spans.size());
+                spans.push_back({i, string::npos, false, uint32_t(open.size() - 1)});
+            } else if (c == '}' && !open.empty()) {
+                size_t k = open.back();
+                open.pop_back();
+                spans[k].close = i;
+                if (spans[k].markup && !open.empty()) spans[open.back()].markup = true;
+                if (one_block && open.empty()) return;
+            }
+        }
+
+        // Unclosed blocks run to the end of input, so each one contains the ones opened after it
+        for (size_t k = open.size(); k-- > 1;) {
+            if (spans[open[k]].markup) spans[open[k - 1]].markup = true;
+        }
+    }
+};
+
+// ======================
+// Parse Events
+// ======================
+// What the Parser reads, one item at a time, for a caller that wants no tree:
+// a Document's tree is built from these same events. Strings are views into the
+// input, and the attributes into the parser; they stay valid until the next event.
+enum ParseEventType {
+    EVENT_START,         // an element and its attributes; its children follow, then its EVENT_END
+    EVENT_END,
+    EVENT_TEXT,
+    EVENT_WHITESPACE,    // blank text spanning lines, kept as a break between nodes
+    EVENT_COMMENT,       // a // or <!-- --> comment
+    EVENT_COMMENT_BLOCK, // a /* */ comment
+    EVENT_PI,            // <?php ?>, another <? ?> or an EML php { } block
+    EVENT_IMPORT         // an EML `import ...;` or <?import ... ?>
+};
+
+struct EventAttr {
+    string_view key;
+    StrRef value; // empty for a boolean attribute
+};
+
+struct ParseEvent {
+    ParseEventType type = EVENT_START;
+    string_view name;                   // START and END: the element's; PI: "php" or "xml"
+    const AtomEntry* builtin = nullptr; // `name` if it is built in (see AtomFlag), or null
+    StrRef content;                     // TEXT, WHITESPACE, COMMENT, COMMENT_BLOCK, PI and IMPORT
+    span<const EventAttr> attrs;        // START, and the PI of an EML php block
+
+    // Source ranges as on Node. START carries begin and body_begin (0 when the
+    // element has no body), END end and body_end; the others all four.
+    size_t begin = 0;
+    size_t end = 0;
+    size_t body_begin = 0;
+    size_t body_end = 0;
+};
+
+// ======================
+// Parser Class
+// ======================
+// How the EML {} blocks a Parser read were handled (see Parser::stats)
+struct BlockStats {
+    size_t syntax_probes = 0; // blocks checked for nested elements (contains_eml_syntax)
+    size_t nested = 0;        // blocks whose content was parsed as elements
+    size_t text = 0;          // blocks read as a single text run
+    size_t raw = 0;           // script/style/php/pre/code blocks kept verbatim
+
+    void add(const BlockStats& o) {
+        syntax_probes += o.syntax_probes;
+        nested += o.nested;
+        text += o.text;
+        raw += o.raw;
+    }
+};
+
+class Parser {
+    string_view input; // the document's source
+    size_t pos;
+    size_t len;
+    Document* doc = nullptr;
+
+    BlockIndex blocks;
+    const BlockIndex* block_index = nullptr; // `blocks`, or the index of the parser this one works for
+    size_t block_cursor = 0;                 // see BlockIndex::find
+    size_t unterminated_import = string::npos; // first `import` whose ';' lookup failed
+
+    // An element started and not yet ended. While an EML block of nested
+    // elements is open, `len` is clamped to its closing brace.
+    struct OpenElement {
+        string_view name;
+        const AtomEntry* builtin;
+        size_t end = 0;       // EML: the block's '}', or the end of input
+        size_t outer_len = 0; // EML: `len` around the block
+    };
+
+    // Where next_event picks up. A step that reads more than one event - an
+    // element without nested children comes whole - hands out the first and
+    // queues the rest.
+    vector<OpenElement> open_elements; // innermost last
+    vector<size_t> end_candidates;     // HTML: indices into open_elements of those with TAG_OPTIONAL_CLOSE or TAG_SCOPE
+    vector<EventAttr> attr_buffer;     // the attributes of the last start tag read
+    ParseEvent queued[3];
+    uint8_t queued_count = 0;
+    uint8_t queued_next = 0;
+    bool eml_events = false;
+    bool fragment = false;         // reading one element only (a reparse), done when it ends
+    size_t fragment_base = 0;      // HTML fragment: open_elements below the element reread, its ancestors
+    bool events_done = false;
+    size_t stop = string::npos;    // EML chunk: no top-level node starts at or past here
+
+    // A run of sibling nodes parsed on a worker thread, into a document of its own
+    struct EmlChunk {
+        size_t begin = 0;        // where the worker started
+        size_t end = 0;          // where the next chunk starts
+        size_t stop = 0;         // where the worker stopped: the first node start at or past `end`
+        Node* holder = nullptr;  // the chunk's nodes are its children; null if the worker failed
+        Document doc;
+        BlockStats stats;
+        size_t unterminated_import = string::npos;
+        bool adopted = false;
+        vector<Atom> atom_map;   // a name that is not built in, by id past the built-ins: its atom here
+    };
+
+    // The chunks of a parallel parse and the block whose children they are
+    struct EmlSplit {
+        size_t open = string::npos; // its '{', or npos for the root
+        size_t end = 0;             // its '}', or the end of input
+        vector<EmlChunk> chunks;
+    };
+    EmlSplit* split = nullptr; // waiting to be adopted, during a parallel parse
+
+public:
+    // Markup input is HTML: a start tag may end open elements whose end tag HTML
+    // lets authors omit (see implies_end_tag). Off for XML, where only end tags
+    // close elements.
+    bool html = false;
+
+    // Where to count blocks, or null (the default) to count nothing
+    BlockStats* stats = nullptr;
+
+    // Threads for one EML document of PARALLEL_MIN bytes or more. The nodes
+    // under the root - or under the block holding most of the input - are cut
+    // into chunks at block ends and parsed concurrently. The tree comes out the
+    // same as on one thread.
+    unsigned threads = 1;
+    static constexpr size_t PARALLEL_MIN = size_t(1) << 20;
+    static constexpr size_t PARALLEL_CHUNK_MIN = size_t(1) << 16;
+
+    // Copies the input once into the returned document
+    Document parse(const string& in, bool is_eml_format) {
+        return parse(string(in), is_eml_format);
+    }
+
+    // Adopts the input buffer; node strings are views into it
+    Document parse(string&& in, bool is_eml_format) {
+        return parse(make_unique<StringSource>(std::move(in)), is_eml_format);
+    }
+
+    Document parse(unique_ptr<SourceBuffer> src, bool is_eml_format) {
+        Document result(src->text().length());
+        input = result.set_source(std::move(src));
+        pos = 0;
+        len = input.length();
+        doc = &result;
+        unterminated_import = string::npos;
+        
+        Node* root = make_node(ELEMENT);
+        root->tag = ATOM_ROOT;
+        root->explicit_empty_block = false;
+        result.root = root;
+
+        reset_events(is_eml_format);
+        if (is_eml_format) {
+            blocks.build(input);
+            block_index = &blocks;
+            block_cursor = 0;
+            if (threads > 1 && len >= PARALLEL_MIN) parse_eml_parallel(root);
+            else build_tree(root);
+        } else {
+            build_tree(root);
+        }
+        root->end = len;
+        doc = nullptr;
+        input = {};
+        return result;
+    }
+
+    // --- Incremental Reparse (see session.h) ---
+    // These parse one piece of an edited `text` into an existing document.
+    // New nodes are views into `text`.
+
+    // Re-read the body of EML element `el`, whose '{' is now at `open`. Fails,
+    // leaving `el` untouched, unless the block still closes at `expected_close`.
+    bool reparse_eml_block(Document& d, string_view text, Node* el, size_t open, size_t expected_close) {
+        input = text;
+        len = text.length();
+        doc = &d;
+        reset_events(true);
+        fragment = true;
+
+        blocks.build_block(text, open);
+        block_index = &blocks;
+        block_cursor = 0;
+        const BlockIndex::Span* span = find_block(open);
+        bool same_extent = span && span->close == expected_close;
+        if (same_extent) {
+            el->children.clear();
+            el->content = {};
+            pos = open + 1;
+            // `el` keeps its name and attributes and takes the rest from the events
+            ParseEvent start;
+            start.name = el->tag.text();
+            start.builtin = BUILTIN_ATOMS.find(start.name, atom_hash(start.name));
+            start.begin = el->begin;
+            open_eml_block(start);
+            el->type = start.type == EVENT_PI ? PI : ELEMENT;
+            el->body_begin = start.body_begin;
+            el->body_end = start.body_end;
+            if (el->type == PI) set_leaf(el, start);
+            else build_tree(el);
+        }
+        doc = nullptr;
+        input = {};
+        return same_extent;
+    }
+
+    // Parse the markup element whose '<' is at `begin`, inside `ancestors`
+    // (outermost first). Returns null unless it still ends at `expected_end`.
+    // In HTML the ancestors are open around it as in a full parse: an end tag
+    // or a start tag that ends one of them ends the element, and an end tag
+    // naming none of them nor anything inside is dropped.
+    Node* reparse_markup_element(Document& d, string_view text, size_t begin, size_t expected_end,
+                                 const vector<const Node*>& ancestors = {}) {
+        input = text;
+        len = text.length();
+        doc = &d;
+        pos = begin;
+        reset_events(false);
+        fragment = true;
+        if (html) {
+            for (const Node* a : ancestors) {
+                string_view name = a->tag.text();
+                push_open_element({name, BUILTIN_ATOMS.find(name, atom_hash(name))});
+            }
+            fragment_base = open_elements.size();
+        }
+
+        Node* el = nullptr;
+        bool open_tag = begin + 1 < len && input[begin] == '<' && input[begin + 1] != '/' && input[begin + 1] != '?'
+            && input.compare(begin, 4, "<!--") != 0;
+        if (open_tag) {
+            Node* holder = make_node(ELEMENT);
+            build_tree(holder);
+            el = holder->children[0];
+            if (pos != expected_end) el = nullptr;
+        }
+        doc = nullptr;
+        input = {};
+        return el;
+    }
+
+    // --- Events ---
+    // Read a document as events instead of into a Document: begin_events, then
+    // next_event until it returns false, or read_events with a handler. Every
+    // START is matched by an END, also for elements the input leaves open.
+    // Nothing is allocated per event. `threads` does not apply.
+
+    // Start reading `in`, which must outlive the reading
+    void begin_events(string_view in, bool is_eml_format) {
+        input = in;
+        pos = 0;
+        len = in.length();
+        reset_events(is_eml_format);
+        if (is_eml_format) {
+            blocks.build(input);
+            block_index = &blocks;
+            block_cursor = 0;
+        }
+    }
+
+    // The next event into `ev`, or false once the input is read
+    bool next_event(ParseEvent& ev) {
+        if (queued_next < queued_count) {
+            ev = queued[queued_next++];
+            if (queued_next == queued_count) queued_next = queued_count = 0;
+            return true;
+        }
+        return eml_events ? next_eml_event(ev) : next_markup_event(ev);
+    }
+
+    // Hand each event of `in` to `handler(const ParseEvent&)`, which returns false
+    // to stop there. Returns false if it was stopped; next_event goes on from there.
+    template <class Handler>
+    bool read_events(string_view in, bool is_eml_format, Handler&& handler) {
+        begin_events(in, is_eml_format);
+        ParseEvent ev;
+        while (next_event(ev)) {
+            if (!handler(static_cast<const ParseEvent&>(ev))) return false;
+        }
+        return true;
+    }
+
+    // Position of the first `import` in the last parse whose ';' lookup came up
+    // empty; inserting a ';' after it can change how everything up to there parses
+    size_t first_unterminated_import() const { return unterminated_import; }
+
+private:
+    char peek() { return pos < len ? input[pos] : 0; }
+    char advance() { return pos < len ? input[pos++] : 0; }
+    bool eof() { return pos >= len; }
+    
+    void skip_whitespace() {
+        skip_to<SpaceEnd>();
+    }
+
+    // Advance to the first byte of a scan.h byte class, or the end
+    template <class Class>
+    void skip_to() {
+        pos = scan<Class>(input.substr(0, len), pos);
+    }
+
+    // To the closing `q` of a quoted value, or the end
+    void skip_to_quote(char q) {
+        if (q == '"') skip_to<QuoteEnd<'"'>>();
+        else skip_to<QuoteEnd<'\''>>();
+    }
+
+    // A tag or attribute name (is_ident_part characters)
+    string_view read_name() {
+        size_t start = pos;
+        skip_to<NameEnd>();
+        return view(start, pos - start);
+    }
+    
+    string_view view(size_t start, size_t n = string::npos) {
+        return input.substr(start, n);
+    }
+
+    Node* make_node(NodeType t) { return doc->make_node(t); }
+    Atom intern(string_view name) { return doc->intern(name); }
+
+    // --- Tree Building ---
+
+    // Add the nodes of the events, up to the end of the run, under `root`. In a
+    // fragment the element being reread is `root` itself: its END finishes it.
+    void build_tree(Node* root) {
+        vector<Node*> stack; // elements started and not yet ended, innermost last
+        Node* parent = root;
+        ParseEvent ev;
+        while (next_event(ev)) {
+            if (ev.type == EVENT_START) {
+                Node* el = make_node(ELEMENT);
+                el->tag = ev.builtin ? Atom(ev.builtin) : intern(ev.name);
+                el->begin = ev.begin;
+                el->body_begin = ev.body_begin;
+                el->body_end = ev.body_end;
+                if (!ev.attrs.empty()) {
+                    el->attrs.reserve(ev.attrs.size());
+                    for (const EventAttr& a : ev.attrs) el->attrs.push_back({intern(a.key), a.value, " "});
+                }
+                parent->add_child(el);
+                stack.push_back(el);
+                parent = el;
+                // The block the chunks were cut from; its children are read next, none queued
+                if (split && split->open + 1 == ev.body_begin && queued_count == 0) adopt_chunks(el);
+            } else if (ev.type == EVENT_END) {
+                // <tag></tag> and tag {} keep their empty body; <tag/> and a bare tag have none
+                Node* el = parent;
+                el->end = ev.end;
+                el->body_end = ev.body_end;
+                el->explicit_empty_block = el->body_begin != 0 && el->children.empty() && el->content.empty();
+                if (stack.empty()) continue;
+                stack.pop_back();
+                parent = stack.empty() ? root : stack.back();
+            } else {
+                Node* n = make_node(leaf_type(ev.type));
+                set_leaf(n, ev);
+                parent->add_child(n);
+            }
+        }
+    }
+
+    // The node an event other than START and END becomes
+    static NodeType leaf_type(ParseEventType t) {
+        switch (t) {
+            case EVENT_TEXT: return TEXT;
+            case EVENT_WHITESPACE: return WHITESPACE;
+            case EVENT_COMMENT: return COMMENT;
+            case EVENT_COMMENT_BLOCK: return COMMENT_BLOCK;
+            case EVENT_IMPORT: return IMPORT;
+            default: return PI; // EVENT_PI
+        }
+    }
+
+    // Everything but the type of a node read whole: text, a comment, a PI or an import
+    void set_leaf(Node* n, const ParseEvent& ev) {
+        if (ev.type == EVENT_PI) n->tag = Atom(ev.builtin);
+        for (const EventAttr& a : ev.attrs) n->attrs.push_back({intern(a.key), a.value, " "});
+        n->content = ev.content;
+        n->begin = ev.begin;
+        n->end = ev.end;
+        n->body_begin = ev.body_begin;
+        n->body_end = ev.body_end;
+        n->explicit_empty_block = n->body_begin != 0 && n->content.empty(); // php {}
+    }
+
+    // --- Event Reading ---
+
+    // Read from `pos` afresh, as a document of the given kind
+    void reset_events(bool is_eml_format) {
+        eml_events = is_eml_format;
+        open_elements.clear();
+        end_candidates.clear();
+        queued_count = queued_next = 0;
+        fragment = false;
+        fragment_base = 0;
+        events_done = false;
+        stop = string::npos;
+        unterminated_import = string::npos;
+    }
+
+    ParseEvent& leaf_event(ParseEvent& ev, ParseEventType type, StrRef content, size_t begin, size_t end) {
+        ev.type = type;
+        ev.name = {};
+        ev.builtin = nullptr;
+        ev.content = content;
+        ev.attrs = {};
+        ev.begin = begin;
+        ev.end = end;
+        ev.body_begin = ev.body_end = 0;
+        return ev;
+    }
+
+    ParseEvent& start_event(ParseEvent& ev, string_view name, size_t begin) {
+        ev.type = EVENT_START;
+        ev.name = name;
+        ev.builtin = BUILTIN_ATOMS.find(name, atom_hash(name));
+        ev.content = {};
+        ev.attrs = attr_buffer;
+        ev.begin = begin;
+        ev.end = ev.body_begin = ev.body_end = 0;
+        return ev;
+    }
+
+    // The END of an element, which has just been taken off open_elements if it was on it
+    ParseEvent& end_event(ParseEvent& ev, string_view name, const AtomEntry* builtin, size_t body_end) {
+        ev.type = EVENT_END;
+        ev.name = name;
+        ev.builtin = builtin;
+        ev.content = {};
+        ev.attrs = {};
+        ev.begin = ev.body_begin = 0;
+        ev.end = pos;
+        ev.body_end = body_end;
+        if (fragment && open_elements.size() == fragment_base) events_done = true; // the element reread has ended
+        return ev;
+    }
+
+    ParseEvent& queue_event() { return queued[queued_count++]; }
+
+    // --- EML Parsing ---
+
+    const BlockIndex::Span* find_block(size_t open) {
+        return block_index->find(open, block_cursor);
+    }
+
+    // Position of the '}' closing the block opened at `open`, or `len` if it is never closed.
+    size_t block_end(const BlockIndex::Span* block) {
+        if (!block || block->close == string::npos) return len;
+        return block->close;
+    }
+
+    // Read on to the next event, up to `len` or (for a chunk of a parallel
+    // parse) until a top-level node would start at or past `stop`. Nested
+    // blocks are read in place on one cursor, their elements kept on
+    // open_elements.
+    bool next_eml_event(ParseEvent& ev) {
+        while (!events_done) {
+            if (pos >= stop && open_elements.empty()) break;
+            if (eof()) {
+                if (open_elements.empty()) break;
+                OpenElement b = open_elements.back();
+                open_elements.pop_back();
+                len = b.outer_len;
+                pos = (b.end < len) ? b.end + 1 : len; // consume closing
+                end_event(ev, b.name, b.builtin, b.end);
+                return true;
+            }
+
+            size_t start_ws = pos;
+            skip_whitespace();
+            if (pos > start_ws) {
+                // capture pure vertical whitespace
+                if (std::count(input.begin() + start_ws, input.begin() + pos, '\n') > 1) {
+                    leaf_event(ev, EVENT_WHITESPACE, view(start_ws, pos - start_ws), start_ws, pos);
+                    return true;
+                }
+            }
+            if (eof()) continue;
+
+            if (peek() == '/' && pos + 1 < len) {
+                if (input[pos+1] == '/') {
+                    // Line Comment
+                    size_t begin = pos;
+                    pos += 2;
+                    size_t cstart = pos;
+                    while (!eof() && peek() != '\n') advance();
+                    leaf_event(ev, EVENT_COMMENT, trim(view(cstart, pos - cstart)), begin, pos);
+                    return true;
+                } else if (input[pos+1] == '*') {
+                    // Block Comment
+                    size_t begin = pos;
+                    pos += 2;
+                    size_t cstart = pos;
+                    size_t cend = input.find("*/", pos);
+                    if (cend == string::npos || cend + 2 > len) cend = len;
+                    pos = (cend == len) ? len : cend + 2;
+                    leaf_event(ev, EVENT_COMMENT_BLOCK, view(cstart, cend - cstart), begin, pos);
+                    return true;
+                }
+            }
+
+            // Import special
+            if (pos + 6 <= len && input.compare(pos, 6, "import") == 0 && (pos+6 >= len || isspace(input[pos+6]))) {
+                size_t begin = pos;
+                pos += 6;
+                size_t istart = pos;
+                size_t iend = input.find(';', pos);
+                if (iend != string::npos && iend < len) {
+                    pos = iend + 1;
+                    leaf_event(ev, EVENT_IMPORT, trim(view(istart, iend - istart)), begin, pos);
+                    return true;
+                }
+                unterminated_import = min(unterminated_import, begin);
+            }
+            
+            if (!is_ident_start(peek())) {
+                // Unexpected char, advance to avoid infinite loop
+                advance(); 
+                continue; 
+            }
+
+            // Tag Name
+            size_t begin = pos;
+            string_view name = read_name();
+            skip_whitespace();
+            
+            // Attributes
+            attr_buffer.clear();
+            if (!eof() && peek() == '(') {
+                advance(); // (
+                parse_eml_attrs();
+            }
+            start_event(ev, name, begin);
+            
+            skip_whitespace();
+            
+            // Content
+            if (!eof() && peek() == '{') {
+                advance(); // {
+                open_eml_block(ev);
+            } else {
+                // No content block -> "tag" or "tag (attrs)"
+                end_event(queue_event(), name, ev.builtin, 0);
+            }
+            return true;
+        }
+        events_done = true;
+        return false;
+    }
+
+    // Read the body of the element `ev` starts, just after its '{'. Text and raw
+    // blocks are consumed whole, queueing the element's text and END. A block of
+    // nested elements is left open for next_eml_event to read up to its closing
+    // brace. A php block turns `ev` into the PI it is.
+    void open_eml_block(ParseEvent& ev) {
+        ev.body_begin = pos;
+
+        // Mode detection: code (php/script/style) and naive text (pre/code) blocks are raw
+        if (!(ev.builtin && (ev.builtin->flags & TAG_RAW_TEXT))) {
+             // EML allows "div { Some Text }" or "div { span { } }".
+             // Text blocks become a single TEXT child.
+             const BlockIndex::Span* block = find_block(pos - 1);
+             size_t close = block_end(block);
+             ev.body_end = close;
+             bool nested = contains_eml_syntax(block);
+             if (stats) {
+                 stats->syntax_probes++;
+                 (nested ? stats->nested : stats->text)++;
+             }
+             if (nested) {
+                 open_elements.push_back({ev.name, ev.builtin, close, len});
+                 len = close;
+                 return;
+             }
+             // Pure text content (may be whitespace-only or actual text)
+             if (close > pos) leaf_event(queue_event(), EVENT_TEXT, view(pos, close - pos), pos, close);
+             pos = (close < len) ? close + 1 : len; // consume closing
+             end_event(queue_event(), ev.name, ev.builtin, close);
+        } else {
+             if (stats) stats->raw++;
+             // Capture raw content balancing braces
+             StrRef content = read_balanced_braces();
+             ev.body_end = ev.body_begin + content.size();
+             if (ev.name == ATOM_PHP.text()) {
+                 // Treat php as PI for formatting
+                 ev.type = EVENT_PI;
+                 ev.content = content;
+                 ev.end = pos;
+                 return;
+             }
+             // raw content as single text child, even if empty
+             leaf_event(queue_event(), EVENT_TEXT, content, ev.body_begin, ev.body_end);
+             end_event(queue_event(), ev.name, ev.builtin, ev.body_end);
+        }
+    }
+
+    void parse_eml_attrs() {
+        while (!eof() && peek() != ')') {
+            size_t start = pos;
+            skip_whitespace();
+            if (peek() == ')') break;
+            
+            // Key
+            string_view key = read_name();
+            
+            // =
+            skip_whitespace();
+            if (peek() == '=') {
+                advance();
+                skip_whitespace();
+                char q = peek();
+                if (q == '"' || q == '\'') {
+                    advance();
+                    size_t vstart = pos;
+                    skip_to_quote(q);
+                    StrRef val = view(vstart, pos - vstart);
+                    if (!eof()) advance(); // close quote
+                    attr_buffer.push_back({key, val});
+                } else {
+                    // naked value? not standard EML but maybe supported
+                    size_t vstart = pos;
+                     while (!eof() && !isspace(peek()) && peek() != ')' && peek() != ',') advance();
+                     StrRef val = view(vstart, pos - vstart);
+                     attr_buffer.push_back({key, val});
+                }
+            } else {
+                // Boolean attr
+                attr_buffer.push_back({key, ""});
+            }
+            
+            skip_whitespace();
+            if (peek() == ',') advance();
+            if (pos == start) advance(); // stray character such as '{': step over it instead of spinning
+        }
+        if (peek() == ')') advance();
+    }
+    
+    // Decided by the block index while it paired the braces
+    bool contains_eml_syntax(const BlockIndex::Span* block) {
+        return block && block->markup;
+    }
+    
+    StrRef read_balanced_braces() {
+        // We assume we just consumed '{' before calling.
+        size_t end = block_end(find_block(pos - 1));
+        StrRef content = view(pos, end - pos); // content inside braces
+        pos = (end < len) ? end + 1 : len; // consume closing
+        return content;
+    }
+
+    // --- Parallel EML Parsing ---
+
+    // The spine of the document - everything outside the chunks - is parsed
+    // here as usual. When it opens the block the chunks were cut from, it takes
+    // their nodes instead of parsing that stretch itself.
+    void parse_eml_parallel(Node* root) {
+        EmlSplit plan = plan_split();
+        if (plan.chunks.size() < 2) return build_tree(root);
+
+        parallel_for(plan.chunks.size(), threads, [&](size_t i) {
+            Parser worker;
+            try {
+                worker.parse_eml_chunk(*this, plan.chunks[i], plan.end);
+            } catch (const exception&) {
+                plan.chunks[i].holder = nullptr; // parsed in place instead
+            }
+        });
+
+        split = &plan;
+        if (plan.open == string::npos) adopt_chunks(root);
+        build_tree(root);
+        split = nullptr;
+
+        // Names the workers added are this document's atoms now
+        bool remap = any_of(plan.chunks.begin(), plan.chunks.end(), [](const EmlChunk& c) { return !c.atom_map.empty(); });
+        if (remap) parallel_for(plan.chunks.size(), threads, [&](size_t i) { remap_atoms(plan.chunks[i]); });
+    }
+
+    // Cut between the children of the root or, while a single block holds most
+    // of the input, between that block's children. Each cut sits just past a
+    // child's '}', where the sequential loop starts its next node - unless
+    // braces in a comment or quoted value misled the block index, which
+    // adopt_chunks notices.
+    EmlSplit plan_split() const {
+        const vector<BlockIndex::Span>& spans = blocks.all();
+        EmlSplit plan;
+        size_t begin = 0;
+        size_t end = len;
+        size_t first = 0; // first span inside [begin, end)
+        uint32_t depth = 0;
+        size_t wanted = min<size_t>(size_t(threads) * 8, len / PARALLEL_CHUNK_MIN);
+        vector<size_t> cuts;
+        for (int level = 0; level < 8; ++level) {
+            cuts.clear();
+            size_t biggest = string::npos;
+            size_t biggest_size = 0;
+            for (size_t k = first; k < spans.size() && spans[k].open < end; ++k) {
+                const BlockIndex::Span& b = spans[k];
+                if (b.depth != depth) continue;
+                size_t close = b.close == string::npos ? len : b.close; // unclosed: runs to the end
+                if (close - b.open > biggest_size) {
+                    biggest = k;
+                    biggest_size = close - b.open;
+                }
+                if (close == len) break; // so nothing after it is a sibling
+                cuts.push_back(close + 1);
+            }
+            bool descend = cuts.size() < wanted && biggest != string::npos && spans[biggest].markup
+                && biggest_size > (end - begin) / 2;
+            if (!descend) break;
+            plan.open = spans[biggest].open;
+            begin = plan.open + 1;
+            end = plan.open + biggest_size;
+            first = biggest + 1;
+            depth++;
+        }
+
+        vector<size_t> starts = {begin};
+        for (size_t i = 1; i < wanted; ++i) {
+            auto cut = lower_bound(cuts.begin(), cuts.end(), begin + (end - begin) * i / wanted);
+            if (cut != cuts.end() && *cut > starts.back() && *cut < end) starts.push_back(*cut);
+        }
+        plan.end = end;
+        plan.chunks.resize(starts.size());
+        for (size_t i = 0; i < starts.size(); ++i) {
+            plan.chunks[i].begin = starts[i];
+            plan.chunks[i].end = i + 1 < starts.size() ? starts[i + 1] : end;
+        }
+        return plan;
+    }
+
+    // On a worker: parse one chunk of `main`'s input, ending at `container_end`
+    void parse_eml_chunk(const Parser& main, EmlChunk& chunk, size_t container_end) {
+        input = main.input;
+        len = container_end;
+        pos = chunk.begin;
+        doc = &chunk.doc;
+        block_index = main.block_index;
+        block_cursor = 0;
+        stats = main.stats ? &chunk.stats : nullptr;
+        reset_events(true);
+        stop = chunk.end;
+
+        Node* holder = make_node(ELEMENT);
+        build_tree(holder);
+        chunk.stop = pos;
+        chunk.holder = holder;
+        chunk.unterminated_import = unterminated_import;
+        doc = nullptr;
+        input = {};
+    }
+
+    // Give `parent`, whose nodes start at `pos`, the chunks' nodes. A chunk is
+    // only taken if it starts exactly where the previous one stopped, which is
+    // where this loop would have been; from the first that doesn't, the caller
+    // goes on parsing in place.
+    void adopt_chunks(Node* parent) {
+        for (EmlChunk& c : split->chunks) {
+            if (c.begin < pos) continue; // the chunk before ran past this one's start
+            if (c.begin > pos || !c.holder) break;
+            for (Node* n : c.holder->children) parent->add_child(n);
+            if (stats) stats->add(c.stats);
+            unterminated_import = min(unterminated_import, c.unterminated_import);
+            for (const AtomEntry* e : c.doc.added_atoms()) c.atom_map.push_back(intern(e->text));
+            doc->adopt(std::move(c.doc));
+            c.adopted = true;
+            pos = c.stop;
+        }
+        split = nullptr;
+    }
+
+    // Point the chunk's nodes at this document's atoms for names it added
+    static void remap_atoms(EmlChunk& chunk) {
+        if (!chunk.adopted || chunk.atom_map.empty()) return;
+        const uint32_t builtins = uint32_t(size(BUILTIN_ATOMS.entries));
+        auto mapped = [&](Atom a) { return a.id() < builtins ? a : chunk.atom_map[a.id() - builtins]; };
+        vector<Node*> stack(chunk.holder->children.begin(), chunk.holder->children.end());
+        while (!stack.empty()) {
+            Node* node = stack.back();
+            stack.pop_back();
+            node->tag = mapped(node->tag);
+            for (Attribute& a : node->attrs) a.key = mapped(a.key);
+            stack.insert(stack.end(), node->children.begin(), node->children.end());
+        }
+    }
+
+    // --- Markup (HTML/XML) Parsing ---
+    
+    // Read on to the next event, up to the end of input or a closing tag none
+    // of the open elements matches (XML). Open elements are kept on
+    // open_elements rather than the call stack, so any nesting depth parses.
+    // Where one tag ends several elements, each call ends one and finds the
+    // rest still to end on the next.
+    bool next_markup_event(ParseEvent& ev) {
+        while (!events_done) {
+             if (eof()) {
+                 if (open_elements.empty()) break;
+                 close_markup_element(ev);
+                 return true;
+             }
+
+             size_t lt = scan<TagStart>(input.substr(0, len), pos);
+             if (lt > pos) {
+                 size_t begin = pos;
+                 pos = lt;
+                 if (markup_text(ev, begin, lt)) return true;
+                 continue;
+             }
+             
+             if (pos + 4 <= len && input.substr(pos, 4) == "<!--") {
+                 // Comment
+                 size_t begin = pos;
+                 size_t end = input.find("-->", pos);
+                 if (end == string::npos) end = len;
+                 // "<!-->" ends inside its own opener: an empty comment
+                 StrRef content = end > pos + 4 ? trim(view(pos + 4, end - (pos + 4))) : StrRef();
+                 pos = (end == len) ? len : end + 3;
+                 leaf_event(ev, EVENT_COMMENT, content, begin, pos);
+                 return true;
+             }
+             
+             if (pos + 2 <= len && input.substr(pos, 2) == "<?") {
+                 // PI
+                 size_t begin = pos;
+                 size_t end = input.find("?>", pos);
+                 if (end == string::npos) end = len;
+                 string_view raw = end > pos + 2 ? view(pos + 2, end - (pos + 2)) : view(pos + 2, 0); // "<?>" is empty
+                 pos = (end == len) ? len : end + 2;
+                 
+                 // Detect php or import
+                 if (raw.substr(0, 7) == "import ") {
+                     leaf_event(ev, EVENT_IMPORT, raw.substr(7), begin, pos);
+                     return true;
+                 }
+                 bool php = raw.substr(0, 3) == "php";
+                 leaf_event(ev, EVENT_PI, php ? raw.substr(3) : raw, begin, pos);
+                 ev.name = php ? ATOM_PHP.text() : ATOM_XML.text(); // xml: generic
+                 ev.builtin = BUILTIN_ATOMS.find(ev.name, atom_hash(ev.name));
+                 return true;
+             }
+             
+             // Tag
+             if (pos + 1 < len && input[pos+1] == '/') {
+                 // Closing tag: it ends the innermost open element, which consumes
+                 // it if the names match and otherwise leaves it for the next one out.
+                 // One that nothing here opened ends the document (XML) or is
+                 // dropped (HTML).
+                 if (html && !open_elements.empty()) {
+                     // HTML closes every element inside the one named
+                     string_view name = view(pos + 2, scan<NameEnd>(input.substr(0, len), pos + 2) - (pos + 2));
+                     auto match = find_if(open_elements.rbegin(), open_elements.rend(),
+                         [&](const OpenElement& e) { return e.name == name; });
+                     if (match != open_elements.rend()) {
+                         close_markup_element(ev);
+                         return true;
+                     }
+                 }
+                 if (html) {
+                     // A stray end tag with nothing to close is dropped
+                     size_t gt = input.find('>', pos);
+                     pos = (gt == string::npos || gt >= len) ? len : gt + 1;
+                     continue;
+                 }
+                 if (open_elements.empty()) break;
+                 close_markup_element(ev);
+                 return true;
+             }
+             
+             if (html && !end_candidates.empty()) {
+                 string_view next = view(pos + 1, scan<NameEnd>(input.substr(0, len), pos + 1) - (pos + 1));
+                 if (ends_open_element(next)) {
+                     close_markup_element(ev);
+                     return true;
+                 }
+             }
+
+             read_start_tag(ev);
+             return true;
+        }
+        events_done = true;
+        return false;
+    }
+
+    // Text between tags: TEXT, or WHITESPACE if it is blank and spans lines.
+    // Returns false for blank text on one line, which is dropped.
+    bool markup_text(ParseEvent& ev, size_t begin, size_t end) {
+        string_view txt = view(begin, end - begin);
+        ParseEventType type = EVENT_TEXT;
+        if (trim(txt).empty()) {
+            if (std::count(txt.begin(), txt.end(), '\n') == 0) return false;
+            type = EVENT_WHITESPACE;
+        }
+        leaf_event(ev, type, txt, begin, end);
+        return true;
+    }
+
+    // Read an open tag. An element with content is left open for its children
+    // to be read and close_markup_element to end it; one without has its END queued.
+    void read_start_tag(ParseEvent& ev) {
+        // Open Tag
+        size_t begin = pos;
+        pos++; // <
+        string_view name = read_name();
+        
+        // Attrs
+        attr_buffer.clear();
+        while (!eof() && peek() != '>' && peek() != '/') {
+            skip_whitespace();
+            if (!is_ident_start(peek())) { 
+                // Handle weird chars or end of tag
+                if(peek() == '>' || peek() == '/') break;
+                advance(); continue; 
+            }
+            
+            string_view key = read_name();
+            skip_whitespace();
+            StrRef val;
+            
+            if (peek() == '=') {
+                advance();
+                skip_whitespace();
+                char q = peek();
+                if (q == '"' || q == '\'') {
+                    advance();
+                    size_t vstart = pos;
+                    skip_to_quote(q);
+                    val = view(vstart, pos - vstart);
+                    if(!eof()) advance();
+                } else {
+                    size_t vstart = pos;
+                    skip_to<BareValueEnd>();
+                    val = view(vstart, pos - vstart);
+                }
+            }
+            attr_buffer.push_back({key, val});
+        }
+        start_event(ev, name, begin);
+        
+        bool self_closing = false;
+        if (peek() == '/') {
+            self_closing = true;
+            advance();
+        }
+        if (peek() == '>') advance();
+        
+        if (!self_closing && !(ev.builtin && (ev.builtin->flags & TAG_VOID))) {
+            // Children come next
+            ev.body_begin = pos;
+            push_open_element({name, ev.builtin});
+            return;
+        }
+        // <tag /> -> tag (no braces)
+        end_event(queue_event(), name, ev.builtin, 0);
+    }
+
+    void push_open_element(const OpenElement& el) {
+        if (html && el.builtin && (el.builtin->flags & (TAG_OPTIONAL_CLOSE | TAG_SCOPE))) {
+            end_candidates.push_back(open_elements.size());
+        }
+        open_elements.push_back(el);
+    }
+
+    // Whether, in HTML, start tag `next` ends an open element: the innermost one
+    // whose end it implies, unless an element bounding the search comes first.
+    // Only elements that may end or bound are looked at, so deep nesting of
+    // other elements costs nothing here.
+    bool ends_open_element(string_view next) const {
+        for (auto i = end_candidates.rbegin(); i != end_candidates.rend(); ++i) {
+            const OpenElement& e = open_elements[*i];
+            if ((e.builtin->flags & TAG_OPTIONAL_CLOSE) && implies_end_tag(e.name, next)) return true;
+            if ((e.builtin->flags & TAG_SCOPE) && bounds_implied_end(e.name, next)) return false;
+        }
+        return false;
+    }
+
+    // End the innermost open element; `pos` is at its closing tag, another
+    // element's, or the end of input
+    void close_markup_element(ParseEvent& ev) {
+        OpenElement el = open_elements.back();
+        open_elements.pop_back();
+        if (!end_candidates.empty() && end_candidates.back() == open_elements.size()) end_candidates.pop_back();
+        size_t body_end = pos;
+        
+        // consume closing tag
+        if (pos + 2 <= len && input.substr(pos, 2) == "</") {
+            size_t close_start = pos;
+            pos += 2;
+            string_view ctag = read_name();
+            if (ctag == el.name) {
+                while(!eof() && peek() != '>') advance();
+                if(!eof()) advance();
+            } else {
+                // Mismatched tag: leave it for the element around this one
+                pos = close_start;
+            }
+        }
+        end_event(ev, el.name, el.builtin, body_end);
+    }
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+
+#include "eml.h"
+
+using namespace std;
+
+// ======================
+// Binary Trees (.emlb)
+// ======================
+// A parsed tree saved as is, so it can be formatted again without parsing the
+// text it came from. The file is the records below, back to back, in host
+// order: there is nothing to decode, and a loaded tree's strings point
+// straight into the (mapped) file.
+//
+//   EmlbHeader
+//   EmlbString[atom_count]  tag and attribute names
+//   EmlbNode[node_count]    breadth first from the top node, so the children
+//                           of every node are consecutive records
+//   EmlbAttr[attr_count]    the attributes of each node, consecutive
+//   char[string_bytes]      names, text, comments and attribute values;
+//                           short strings that repeat are mostly stored once
+//
+// Every record is a whole number of 32-bit words; all offsets and counts are
+// 32 bits, which limits a tree to 4 GiB of strings.
+static_assert(endian::native == endian::little, ".emlb records are read and written in place as little-endian");
+
+struct EmlbHeader {
+    char magic[4]; // "EMLB"
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t attr_count;
+    uint32_t atom_count;
+    uint32_t string_bytes;
+};
+
+// Bytes [offset, offset + size) of the string table
+struct EmlbString {
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct EmlbNode {
+    uint8_t type; // NodeType
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t tag; // index into the atoms
+    EmlbString content;
+    uint32_t first_child; // children are nodes [first_child, first_child + child_count)
+    uint32_t child_count;
+    uint32_t first_attr;
+    uint32_t attr_count;
+    uint32_t begin; // where the node was in its source text (Node::begin, Node::end)
+    uint32_t end;
+};
+
+struct EmlbAttr {
+    uint32_t key; // index into the atoms
+    EmlbString value;
+    EmlbString separator;
+};
+
+static_assert(sizeof(EmlbHeader) == 24 && sizeof(EmlbNode) == 40 && sizeof(EmlbAttr) == 20);
+
+constexpr uint32_t EMLB_VERSION = 1;
+constexpr uint8_t EMLB_EXPLICIT_EMPTY_BLOCK = 1; // EmlbNode::flags
+
+// Writes a tree as an .emlb file. Throws length_error for a tree too big for
+// the format.
+class EmlbWriter : public Formatter {
+public:
+    using Formatter::format;
+
+    void format(Node* node, Sink& out, int /*indent_level*/ = 0) override {
+        nodes.clear();
+        attrs.clear();
+        atoms.clear();
+        atom_index.clear();
+        strings.clear();
+        recent.assign(RECENT_SLOTS, EmlbString{0, 0});
+        if (!node) return;
+        strings.reserve(node->end > node->begin ? node->end - node->begin : 0); // about what the strings come to
+
+        // Breadth first: a node's children are queued, in order, right after
+        // the children of the nodes before it
+        vector<Node*> order{node};
+        for (size_t i = 0; i < order.size(); ++i) {
+            Node* n = order[i];
+            EmlbNode rec{};
+            rec.type = uint8_t(n->type);
+            rec.flags = n->explicit_empty_block ? EMLB_EXPLICIT_EMPTY_BLOCK : 0;
+            rec.tag = atom(n->tag);
+            rec.content = store(n->content);
+            rec.first_child = count32(order.size());
+            rec.child_count = count32(n->children.size());
+            rec.first_attr = count32(attrs.size());
+            rec.attr_count = count32(n->attrs.size());
+            rec.begin = count32(n->begin);
+            rec.end = count32(n->end);
+            nodes.push_back(rec);
+            for (const auto& a : n->attrs) attrs.push_back({atom(a.key), store(a.value), store(a.separator)});
+            order.insert(order.end(), n->children.begin(), n->children.end());
+        }
+
+        EmlbHeader header{{'E', 'M', 'L', 'B'}, EMLB_VERSION, count32(nodes.size()), count32(attrs.size()),
+                          count32(atoms.size()), count32(strings.size())};
+        write_records(out, &header, 1);
+        write_records(out, atoms.data(), atoms.size());
+        write_records(out, nodes.data(), nodes.size());
+        write_records(out, attrs.data(), attrs.size());
+        out.write(strings);
+    }
+
+private:
+    vector<EmlbNode> nodes;
+    vector<EmlbAttr> attrs;
+    vector<EmlbString> atoms;
+    vector<uint32_t> atom_index; // by Atom::id, UINT32_MAX when not written yet
+    string strings;
+    vector<EmlbString> recent; // short strings in the table, by hash; a newer one takes the slot
+
+    static constexpr size_t SHARED_MAX = 32; // strings up to this size are looked up in `recent`
+    static constexpr size_t RECENT_SLOTS = 1 << 12;
+
+    static uint32_t count32(size_t n) {
+        if (n > UINT32_MAX) throw length_error("Tree too large for .emlb");
+        return uint32_t(n);
+    }
+
+    uint32_t atom(Atom a) {
+        if (a.id() >= atom_index.size()) atom_index.resize(a.id() + 1, UINT32_MAX);
+        uint32_t& index = atom_index[a.id()];
+        if (index == UINT32_MAX) {
+            index = count32(atoms.size());
+            atoms.push_back(store(a.text()));
+        }
+        return index;
+    }
+
+    EmlbString store(string_view s) {
+        if (s.empty()) return {0, 0};
+        EmlbString* slot = nullptr;
+        if (s.size() <= SHARED_MAX) {
+            slot = &recent[atom_hash(s) & (RECENT_SLOTS - 1)];
+            if (slot->size == s.size() && memcmp(strings.data() + slot->offset, s.data(), s.size()) == 0) return *slot;
+        }
+        EmlbString ref{count32(strings.size()), count32(s.size())};
+        count32(strings.size() + s.size());
+        strings.append(s);
+        if (slot) *slot = ref;
+        return ref;
+    }
+
+    template <class T>
+    static void write_records(Sink& out, const T* records, size_t n) {
+        if (n) out.write(string_view(reinterpret_cast<const char*>(records), n * sizeof(T)));
+    }
+};
+
+// Load an .emlb file into `doc`, which takes ownership of `src`. Strings stay
+// in `src`; nodes are made in the document's arena. Every offset and count is
+// checked, so a damaged or foreign file fails here rather than later. On
+// failure returns false and describes why in `error`.
+inline bool load_emlb(unique_ptr<SourceBuffer> src, Document& doc, string& error) {
+    string_view data = src->text();
+    EmlbHeader header;
+    if (data.size() < sizeof header) {
+        error = "Not an .emlb file";
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof header);
+    if (memcmp(header.magic, "EMLB", 4) != 0) {
+        error = "Not an .emlb file";
+        return false;
+    }
+    if (header.version != EMLB_VERSION) {
+        error = "Unsupported .emlb version " + to_string(header.version);
+        return false;
+    }
+    uint64_t atoms_at = sizeof header;
+    uint64_t nodes_at = atoms_at + uint64_t(header.atom_count) * sizeof(EmlbString);
+    uint64_t attrs_at = nodes_at + uint64_t(header.node_count) * sizeof(EmlbNode);
+    uint64_t strings_at = attrs_at + uint64_t(header.attr_count) * sizeof(EmlbAttr);
+    if (header.node_count == 0 || strings_at + header.string_bytes != data.size()) {
+        error = "Damaged .emlb file";
+        return false;
+    }
+
+    doc = Document(size_t(header.node_count) * (sizeof(Node) + 16) + size_t(header.attr_count) * sizeof(Attribute));
+    data = doc.set_source(std::move(src));
+    const char* table = data.data() + strings_at;
+    auto text = [&](EmlbString s, StrRef& out) {
+        if (uint64_t(s.offset) + s.size > header.string_bytes) return false;
+        out = StrRef(table + s.offset, s.size);
+        return true;
+    };
+
+    vector<Atom> atoms(header.atom_count);
+    for (uint32_t i = 0; i < header.atom_count; ++i) {
+        EmlbString s;
+        StrRef name;
+        memcpy(&s, data.data() + atoms_at + i * sizeof s, sizeof s);
+        if (!text(s, name)) {
+            error = "Damaged .emlb file";
+            return false;
+        }
+        atoms[i] = doc.intern(name);
+    }
+
+    // Last node first, so a node's children exist by the time it is made. The
+    // child ranges must cover nodes [1, node_count) once each, in order, and
+    // every child must come after its parent: then the records form one tree.
+    vector<Node*> made(header.node_count);
+    uint32_t unclaimed = header.node_count; // nodes from here on have a parent
+    for (uint32_t i = header.node_count; i-- > 0;) {
+        EmlbNode rec;
+        memcpy(&rec, data.data() + nodes_at + uint64_t(i) * sizeof rec, sizeof rec);
+        bool valid = rec.type <= WHITESPACE && rec.tag < header.atom_count &&
+                     uint64_t(rec.first_child) + rec.child_count == unclaimed &&
+                     (rec.child_count == 0 || rec.first_child > i) &&
+                     uint64_t(rec.first_attr) + rec.attr_count <= header.attr_count;
+        Node* n = valid ? doc.make_node(NodeType(rec.type)) : nullptr;
+        if (n && !text(rec.content, n->content)) n = nullptr;
+        if (!n) {
+            error = "Damaged .emlb file";
+            return false;
+        }
+        n->tag = atoms[rec.tag];
+        n->explicit_empty_block = (rec.flags & EMLB_EXPLICIT_EMPTY_BLOCK) != 0;
+        n->begin = rec.begin;
+        n->end = rec.end;
+        n->attrs.reserve(rec.attr_count);
+        for (uint32_t k = 0; k < rec.attr_count; ++k) {
+            EmlbAttr a;
+            memcpy(&a, data.data() + attrs_at + uint64_t(rec.first_attr + k) * sizeof a, sizeof a);
+            Attribute attr;
+            if (a.key >= header.atom_count || !text(a.value, attr.value) || !text(a.separator, attr.separator)) {
+                error = "Damaged .emlb file";
+                return false;
+            }
+            attr.key = atoms[a.key];
+            n->attrs.push_back(attr);
+        }
+        n->children.assign(made.begin() + rec.first_child, made.begin() + rec.first_child + rec.child_count);
+        unclaimed = rec.first_child;
+        made[i] = n;
+    }
+    if (unclaimed != 1) {
+        error = "Damaged .emlb file";
+        return false;
+    }
+    doc.root = made[0];
+    return true;
+}
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "eml.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EMLC_POSIX_IO 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// ======================
+// File Formats
+// ======================
+enum OutputFormat {
+    FORMAT_EML,
+    FORMAT_HTML, // .html, .php and anything else that is not XML
+    FORMAT_XML,  // .xml, .xaml, .fxml
+    FORMAT_EMLB  // .emlb, a parsed tree (see emlb.h)
+};
+
+inline bool is_eml_path(const string& path) {
+    return ends_with(path, ".eml");
+}
+
+inline OutputFormat output_format_for(const string& path) {
+    if (ends_with(path, ".eml")) return FORMAT_EML;
+    if (ends_with(path, ".emlb")) return FORMAT_EMLB;
+    if (ends_with(path, ".xml") || ends_with(path, ".xaml") || ends_with(path, ".fxml")) return FORMAT_XML;
+    return FORMAT_HTML;
+}
+
+// ======================
+// Input Files
+// ======================
+#ifdef EMLC_POSIX_IO
+// Read-only private mapping of a whole input file. Node strings point straight
+// into the page cache, so the input is never copied. The file must not be
+// truncated while the document is alive.
+class MappedSource : public SourceBuffer {
+public:
+    MappedSource(void* addr, size_t size) : addr(addr), size(size) {}
+    ~MappedSource() override { munmap(addr, size); }
+
+    MappedSource(const MappedSource&) = delete;
+    MappedSource& operator=(const MappedSource&) = delete;
+
+    string_view text() const override { return string_view(static_cast<const char*>(addr), size); }
+
+private:
+    void* addr;
+    size_t size;
+};
+#endif
+
+// True when both paths name the same existing file
+inline bool same_file(const string& a, const string& b) {
+#ifdef EMLC_POSIX_IO
+    struct stat sa, sb;
+    if (stat(a.c_str(), &sa) != 0 || stat(b.c_str(), &sb) != 0) return false;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#else
+    return false;
+#endif
+}
+
+// Load an input file for parsing. Regular files are memory-mapped; pipes and
+// anything else that cannot be mapped are read once into a single buffer.
+// Pass allow_map=false when the file may be rewritten before the document is
+// done with (e.g. it is also the output). Returns null if it cannot be read.
+inline unique_ptr<SourceBuffer> load_input(const string& path, bool allow_map = true) {
+#ifdef EMLC_POSIX_IO
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (regular && allow_map && st.st_size > 0) {
+        size_t size = size_t(st.st_size);
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            madvise(addr, size, MADV_SEQUENTIAL); // the parser reads front to back
+#endif
+            ::close(fd);
+            return make_unique<MappedSource>(addr, size);
+        }
+    }
+
+    // Not mappable: read it in, growing one buffer instead of collecting chunks
+    string text;
+    text.resize(regular && st.st_size > 0 ? size_t(st.st_size) + 1 : size_t(1) << 16);
+    size_t used = 0;
+    while (true) {
+        if (used == text.size()) text.resize(text.size() * 2);
+        ssize_t r = ::read(fd, &text[used], text.size() - used);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        if (r == 0) break;
+        used += size_t(r);
+    }
+    ::close(fd);
+    text.resize(used);
+    return make_unique<StringSource>(std::move(text));
+#else
+    (void)allow_map;
+    ifstream infile(path, output_format_for(path) == FORMAT_EMLB ? ios::in | ios::binary : ios::in);
+    if (!infile.is_open()) return nullptr;
+    stringstream buffer;
+    buffer << infile.rdbuf();
+    return make_unique<StringSource>(std::move(buffer).str());
+#endif
+}
+
+// An input read front to back in pieces, for inputs too big to load whole
+// (see stream.h)
+class InputStream {
+public:
+    bool failed = false;   // a read failed
+    size_t bytes_read = 0; // so far
+
+#ifdef EMLC_POSIX_IO
+    explicit InputStream(const string& path) : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+    ~InputStream() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool is_open() const { return fd >= 0; }
+
+    // Up to `n` bytes into `buf`; 0 at the end, or on an error (see failed)
+    size_t read(char* buf, size_t n) {
+        while (true) {
+            ssize_t r = ::read(fd, buf, n);
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0) failed = true;
+            if (r <= 0) return 0;
+            bytes_read += size_t(r);
+            return size_t(r);
+        }
+    }
+#else
+    explicit InputStream(const string& path) : in(path) {}
+
+    bool is_open() const { return in.is_open(); }
+
+    // Up to `n` bytes into `buf`; 0 at the end, or on an error (see failed)
+    size_t read(char* buf, size_t n) {
+        in.read(buf, streamsize(n));
+        if (in.bad()) failed = true;
+        bytes_read += size_t(in.gcount());
+        return size_t(in.gcount());
+    }
+#endif
+
+    InputStream(const InputStream&) = delete;
+    InputStream& operator=(const InputStream&) = delete;
+
+private:
+#ifdef EMLC_POSIX_IO
+    int fd;
+#else
+    ifstream in;
+#endif
+};
+
+// ======================
+// Output Files
+// ======================
+// A regular file with other hard links (an output installed from the build
+// cache, see cache.h) is unlinked before it is rewritten, so the new bytes go
+// to a file of its own instead of through the link into every other name.
+inline void unshare_output(const string& path) {
+#ifdef EMLC_POSIX_IO
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1) ::unlink(path.c_str());
+#else
+    error_code ec;
+    if (filesystem::is_regular_file(filesystem::symlink_status(path, ec)) && filesystem::hard_link_count(path, ec) > 1) {
+        filesystem::remove(path, ec);
+    }
+#endif
+}
+
+#ifdef EMLC_POSIX_IO
+// Output written straight to the file descriptor in large write(2)/writev(2)
+// calls. Regular files get a big staging buffer; pipes and devices get one
+// sized for the pipe so the reader is fed steadily.
+class OutputFile : public FdSink {
+public:
+    explicit OutputFile(const string& path, bool /*binary*/ = false)
+        : OutputFile((unshare_output(path), ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))) {}
+    ~OutputFile() override { close(); }
+
+    bool is_open() const { return fd >= 0; }
+
+    // Flush and close; false if any write failed
+    bool close() {
+        if (fd < 0) return ok();
+        flush();
+        if (::close(fd) != 0) failed = true;
+        fd = -1;
+        return ok();
+    }
+
+private:
+    explicit OutputFile(int fd) : FdSink(fd, buffer_size_for(fd)) {
+        if (fd < 0) failed = true;
+    }
+
+    static size_t buffer_size_for(int fd) {
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) return size_t(1) << 20;
+        return size_t(1) << 16;
+    }
+};
+#else
+// Output written through an ofstream. `binary` is for outputs that are not
+// text by their extension alone (compressed copies).
+class OutputFile : public BufferedSink {
+public:
+    explicit OutputFile(const string& path, bool binary = false)
+        : out((unshare_output(path), path), binary || output_format_for(path) == FORMAT_EMLB ? ios::out | ios::binary : ios::out) {
+        if (!out.is_open()) failed = true;
+    }
+    ~OutputFile() override { close(); }
+
+    bool is_open() const { return out.is_open(); }
+
+    // Flush and close; false if any write failed
+    bool close() {
+        if (!out.is_open()) return ok();
+        flush();
+        out.close();
+        if (out.fail()) failed = true;
+        return ok();
+    }
+
+protected:
+    void drain(const char* data, size_t n) override { out.write(data, streamsize(n)); }
+
+private:
+    ofstream out;
+};
+#endif
@@ -0,0 +1,88 @@
+#include <new>
+
+#include "libemlc.h"
+#include "convert.h"
+
+using namespace std;
+
+// ======================
+// libemlc
+// ======================
+// The C entry points over a Converter. No exception crosses them: a failure
+// becomes a 0 return and a message in the context.
+struct emlc_context {
+    Converter converter;
+    StringSink out;
+    string error;
+};
+
+static bool is_format(emlc_format f) {
+    return f == EMLC_FORMAT_EML || f == EMLC_FORMAT_HTML || f == EMLC_FORMAT_XML || f == EMLC_FORMAT_EMLB;
+}
+
+static OutputFormat output_format(emlc_format f) {
+    switch (f) {
+        case EMLC_FORMAT_EML: return FORMAT_EML;
+        case EMLC_FORMAT_XML: return FORMAT_XML;
+        case EMLC_FORMAT_EMLB: return FORMAT_EMLB;
+        default: return FORMAT_HTML;
+    }
+}
+
+emlc_context* emlc_context_new(void) {
+    return new (nothrow) emlc_context;
+}
+
+void emlc_context_free(emlc_context* ctx) {
+    delete ctx;
+}
+
+int emlc_convert(emlc_context* ctx, const char* input, size_t input_size, emlc_format from, emlc_format to,
+                 const char** output, size_t* output_size) {
+    if (!ctx) return 0;
+    ctx->out.clear();
+    ctx->error.clear();
+    if ((!input && input_size) || !output || !output_size) {
+        ctx->error = "Missing input or output argument";
+        return 0;
+    }
+    if (!is_format(from) || !is_format(to)) {
+        ctx->error = "Unknown format";
+        return 0;
+    }
+    try {
+        ctx->converter.convert(string_view(input, input_size), output_format(from), output_format(to), ctx->out);
+    } catch (const bad_alloc&) {
+        ctx->out.clear();
+        ctx->error = "Out of memory";
+        return 0;
+    } catch (const exception& e) {
+        ctx->out.clear();
+        ctx->error = e.what();
+        return 0;
+    }
+    *output = ctx->out.view().data();
+    *output_size = ctx->out.size();
+    return 1;
+}
+
+void emlc_set_minify(emlc_context* ctx, int minify) {
+    if (ctx) ctx->converter.output.minify = minify != 0;
+}
+
+const char* emlc_error(const emlc_context* ctx) {
+    return ctx ? ctx->error.c_str() : "No context";
+}
+
+emlc_format emlc_format_for_path(const char* path) {
+    switch (output_format_for(path ? path : "")) {
+        case FORMAT_EML: return EMLC_FORMAT_EML;
+        case FORMAT_XML: return EMLC_FORMAT_XML;
+        case FORMAT_EMLB: return EMLC_FORMAT_EMLB;
+        default: return EMLC_FORMAT_HTML;
+    }
+}
+
+const char* emlc_version(void) {
+    return VERSION.c_str();
+}
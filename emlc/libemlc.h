@@ -0,0 +1,124 @@
+#pragma once
+
+// ======================
+// libemlc
+// ======================
+// EML conversion in memory, for embedding. A context holds a parser, the
+// formatters and an output buffer, all reused from one call to the next.
+// Contexts are independent of each other: use one per thread, or guard a shared
+// one. Nothing here reads or writes files. Usable from C99 and C++.
+//
+//   emlc_context* ctx = emlc_context_new();
+//   const char* html;
+//   size_t html_size;
+//   if (!emlc_convert(ctx, eml, eml_size, EMLC_FORMAT_EML, EMLC_FORMAT_HTML, &html, &html_size))
+//       fprintf(stderr, "%s\n", emlc_error(ctx));
+//   emlc_context_free(ctx);
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(EMLC_SHARED)
+#ifdef EMLC_BUILDING
+#define EMLC_API __declspec(dllexport)
+#else
+#define EMLC_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define EMLC_API __attribute__((visibility("default")))
+#else
+#define EMLC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum emlc_format {
+    EMLC_FORMAT_EML,
+    EMLC_FORMAT_HTML, // HTML and PHP: read with HTML rules, written with HTML void elements
+    EMLC_FORMAT_XML,  // XML, XAML, FXML
+    EMLC_FORMAT_EMLB  // a parsed tree, saved to be formatted again without parsing
+} emlc_format;
+
+typedef struct emlc_context emlc_context;
+
+// A new context, or NULL if out of memory
+EMLC_API emlc_context* emlc_context_new(void);
+EMLC_API void emlc_context_free(emlc_context* ctx);
+
+// Convert `input_size` bytes of `input` from one format to another. On success
+// returns 1 and points `*output` at the result, which stays valid until the next
+// call on `ctx` or until it is freed; it is not NUL-terminated. On failure
+// returns 0 and emlc_error() says why.
+EMLC_API int emlc_convert(emlc_context* ctx, const char* input, size_t input_size, emlc_format from,
+                          emlc_format to, const char** output, size_t* output_size);
+
+// Minified HTML and XML output from `ctx` from now on; 0 turns it back off
+EMLC_API void emlc_set_minify(emlc_context* ctx, int minify);
+
+// Why the last conversion on `ctx` failed, or ""
+EMLC_API const char* emlc_error(const emlc_context* ctx);
+
+// The format emlc picks for a file name by its extension
+EMLC_API emlc_format emlc_format_for_path(const char* path);
+
+EMLC_API const char* emlc_version(void);
+
+#ifdef __cplusplus
+}
+
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace emlc {
+
+// Owns an emlc_context
+class Context {
+public:
+    Context() : ctx(emlc_context_new()) {
+        if (!ctx) throw std::bad_alloc();
+    }
+    ~Context() { emlc_context_free(ctx); }
+
+    Context(Context&& o) noexcept : ctx(o.ctx) { o.ctx = nullptr; }
+    Context& operator=(Context&& o) noexcept {
+        std::swap(ctx, o.ctx);
+        return *this;
+    }
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    void set_minify(bool minify) { emlc_set_minify(ctx, minify); }
+
+    // The output is a view into the context, valid until its next conversion.
+    // On failure returns false and describes why in `error`.
+    bool convert(std::string_view input, emlc_format from, emlc_format to, std::string_view& output,
+                 std::string& error) {
+        const char* data;
+        size_t size;
+        if (!emlc_convert(ctx, input.data(), input.size(), from, to, &data, &size)) {
+            error = emlc_error(ctx);
+            return false;
+        }
+        output = std::string_view(data, size);
+        return true;
+    }
+
+private:
+    emlc_context* ctx;
+};
+
+// One-off conversion on a context kept per calling thread
+inline bool convert(std::string_view input, emlc_format from, emlc_format to, std::string& output,
+                    std::string& error) {
+    thread_local Context context;
+    std::string_view result;
+    if (!context.convert(input, from, to, result, error)) return false;
+    output.assign(result);
+    return true;
+}
+
+} // namespace emlc
+#endif
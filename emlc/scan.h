@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EMLC_SSE2 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define EMLC_TARGET_AVX2
+#else
+#define EMLC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+
+// ======================
+// Delimiter Scanning
+// ======================
+// Vectorized versions of the parser's character-at-a-time loops: find the end
+// of a name, a run of whitespace, an attribute value or the text before the
+// next tag. Each scan looks at 16 bytes (SSE2) or 32 bytes (AVX2, picked at
+// runtime when the CPU has it) per step, and finishes the last partial block
+// one byte at a time, so it never reads past the end of the input. Builds for
+// other targets use the scalar loops.
+//
+// A byte class names where a scan stops: stop(c) for one byte, and stop16 /
+// stop32 for a whole vector, 0xFF in every lane that stops. The classes match
+// the <cctype> tests the parser used before, in the "C" locale.
+
+enum ScanIsa { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+
+inline ScanIsa detect_scan_isa() {
+#ifdef EMLC_SSE2
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return SCAN_SSE2;
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5)) ? SCAN_AVX2 : SCAN_SSE2;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? SCAN_AVX2 : SCAN_SSE2;
+#endif
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+// Kernels in use. Starts out as what the CPU supports; benchmarks and tests may
+// lower it. Read before static initialization has run it is SCAN_SCALAR, which
+// is always safe.
+inline ScanIsa scan_isa = detect_scan_isa();
+
+inline bool is_space_byte(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#ifdef EMLC_SSE2
+inline unsigned lowest_bit(unsigned mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return unsigned(i);
+#else
+    return unsigned(__builtin_ctz(mask));
+#endif
+}
+
+// Lanes equal to `c`, and lanes in [lo, hi]. Compares are signed, so bytes
+// >= 0x80 are never in an ASCII range.
+inline __m128i lanes_eq(__m128i x, char c) { return _mm_cmpeq_epi8(x, _mm_set1_epi8(c)); }
+inline __m128i lanes_in(__m128i x, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(char(lo - 1))), _mm_cmplt_epi8(x, _mm_set1_epi8(char(hi + 1))));
+}
+inline __m128i lanes_or(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+inline __m128i lanes_not(__m128i x) { return _mm_xor_si128(x, _mm_set1_epi8(-1)); }
+inline __m128i lanes_lower(__m128i x) { return _mm_or_si128(x, _mm_set1_epi8(0x20)); }
+
+EMLC_TARGET_AVX2 inline __m256i lanes_eq(__m256i x, char c) { return _mm256_cmpeq_epi8(x, _mm256_set1_epi8(c)); }
+EMLC_TARGET_AVX2 inline __m256i lanes_in(__m256i x, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(char(lo - 1))), _mm256_cmpgt_epi8(_mm256_set1_epi8(char(hi + 1)), x));
+}
+EMLC_TARGET_AVX2 inline __m256i lanes_or(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+EMLC_TARGET_AVX2 inline __m256i lanes_not(__m256i x) { return _mm256_xor_si256(x, _mm256_set1_epi8(-1)); }
+EMLC_TARGET_AVX2 inline __m256i lanes_lower(__m256i x) { return _mm256_or_si256(x, _mm256_set1_epi8(0x20)); }
+
+// Both widths share one expression over `x`
+#define EMLC_BYTE_CLASS(test)                                        \
+    static __m128i stop16(__m128i x) { return test; }                \
+    EMLC_TARGET_AVX2 static __m256i stop32(__m256i x) { return test; }
+#else
+#define EMLC_BYTE_CLASS(test)
+#endif
+
+#define EMLC_SPACE_LANES(x) lanes_or(lanes_eq(x, ' '), lanes_in(x, '\t', '\r'))
+
+// End of a tag or attribute name: anything but [A-Za-z0-9_.:-] (is_ident_part)
+struct NameEnd {
+    static bool stop(char c) {
+        bool alpha = (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+        return !(alpha || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' || c == ':');
+    }
+    EMLC_BYTE_CLASS(lanes_not(lanes_or(
+        lanes_or(lanes_in(lanes_lower(x), 'a', 'z'), lanes_in(x, '0', '9')),
+        lanes_or(lanes_or(lanes_eq(x, '-'), lanes_eq(x, '_')), lanes_or(lanes_eq(x, '.'), lanes_eq(x, ':'))))))
+};
+
+// Start of a run of whitespace
+struct SpaceStart {
+    static bool stop(char c) { return is_space_byte(c); }
+    EMLC_BYTE_CLASS(EMLC_SPACE_LANES(x))
+};
+
+// End of a run of whitespace (isspace)
+struct SpaceEnd {
+    static bool stop(char c) { return !is_space_byte(c); }
+    EMLC_BYTE_CLASS(lanes_not(EMLC_SPACE_LANES(x)))
+};
+
+// Start of the next tag
+struct TagStart {
+    static bool stop(char c) { return c == '<'; }
+    EMLC_BYTE_CLASS(lanes_eq(x, '<'))
+};
+
+// Closing quote of an attribute value
+template <char Q>
+struct QuoteEnd {
+    static bool stop(char c) { return c == Q; }
+    EMLC_BYTE_CLASS(lanes_eq(x, Q))
+};
+
+// End of an unquoted attribute value: whitespace, '>' or '/'
+struct BareValueEnd {
+    static bool stop(char c) { return is_space_byte(c) || c == '>' || c == '/'; }
+    EMLC_BYTE_CLASS(lanes_or(EMLC_SPACE_LANES(x), lanes_or(lanes_eq(x, '>'), lanes_eq(x, '/'))))
+};
+// EML block structure: braces, and the '(' that may open an attribute list
+struct BlockEvent {
+    static bool stop(char c) { return c == '{' || c == '}' || c == '('; }
+    EMLC_BYTE_CLASS(lanes_or(lanes_or(lanes_eq(x, '{'), lanes_eq(x, '}')), lanes_eq(x, '(')))
+};
+#undef EMLC_BYTE_CLASS
+#undef EMLC_SPACE_LANES
+
+// Kernels: index of the first byte in [pos, len) the class stops at, or len
+template <class Class>
+size_t scan_scalar(const char* s, size_t pos, size_t len) {
+    while (pos < len && !Class::stop(s[pos])) ++pos;
+    return pos;
+}
+
+#ifdef EMLC_SSE2
+template <class Class>
+size_t scan_sse2(const char* s, size_t pos, size_t len) {
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+        unsigned mask = unsigned(_mm_movemask_epi8(Class::stop16(x)));
+        if (mask) return pos + lowest_bit(mask);
+    }
+    return scan_scalar<Class>(s, pos, len);
+}
+
+template <class Class>
+EMLC_TARGET_AVX2 size_t scan_avx2(const char* s, size_t pos, size_t len) {
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + pos));
+        unsigned mask = unsigned(_mm256_movemask_epi8(Class::stop32(x)));
+        if (mask) return pos + lowest_bit(mask);
+    }
+    return scan_sse2<Class>(s, pos, len);
+}
+#endif
+
+// Scan `s` from `pos` to the first byte of `Class`. Names, spaces and most
+// values end within a few bytes, so the first 16 are checked inline and only
+// longer runs go on to a loop.
+template <class Class>
+inline size_t scan(string_view s, size_t pos) {
+    size_t len = s.size();
+#ifdef EMLC_SSE2
+    if (pos + 16 <= len && scan_isa != SCAN_SCALAR) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+        unsigned mask = unsigned(_mm_movemask_epi8(Class::stop16(x)));
+        if (mask) return pos + lowest_bit(mask);
+        if (scan_isa == SCAN_AVX2) return scan_avx2<Class>(s.data(), pos + 16, len);
+        return scan_sse2<Class>(s.data(), pos + 16, len);
+    }
+#endif
+    return scan_scalar<Class>(s.data(), pos, len);
+}
@@ -0,0 +1,404 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "convert.h"
+
+#ifdef EMLC_POSIX_IO
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+using namespace std;
+
+// ======================
+// Result Cache
+// ======================
+// Converted outputs kept in memory, keyed by a hash of the input bytes, the
+// two formats and the request flags. Holds at most `capacity` bytes of output; the least recently
+// used entries go first. Outputs are shared, so an entry evicted while it is
+// being sent stays alive until the send is done.
+class ResultCache {
+public:
+    size_t hits = 0;
+    size_t misses = 0;
+
+    explicit ResultCache(size_t capacity) : capacity(capacity) {}
+
+    static Hash128 key_for(string_view input, OutputFormat input_format, OutputFormat format, unsigned flags) {
+        return hash128(input, uint64_t(flags) << 16 | uint64_t(input_format) << 8 | uint64_t(format));
+    }
+
+    shared_ptr<const string> find(const Hash128& key) {
+        lock_guard<mutex> guard(lock);
+        auto found = index.find(key);
+        if (found == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        order.splice(order.begin(), order, found->second);
+        return found->second->output;
+    }
+
+    void insert(const Hash128& key, shared_ptr<const string> output) {
+        if (output->size() >= capacity) return;
+        lock_guard<mutex> guard(lock);
+        if (index.count(key)) return; // another worker converted the same input meanwhile
+        bytes += output->size();
+        order.push_front({key, std::move(output)});
+        index[key] = order.begin();
+        while (bytes > capacity) {
+            bytes -= order.back().output->size();
+            index.erase(order.back().key);
+            order.pop_back();
+        }
+    }
+
+private:
+    struct Entry {
+        Hash128 key;
+        shared_ptr<const string> output;
+    };
+    struct KeyHash {
+        size_t operator()(const Hash128& h) const { return size_t(h.lo); }
+    };
+
+    size_t capacity;
+    size_t bytes = 0;
+    mutex lock;
+    list<Entry> order; // most recently used first
+    unordered_map<Hash128, list<Entry>::iterator, KeyHash> index;
+};
+
+// ======================
+// Compile Server
+// ======================
+// Stays resident on a Unix-domain socket and converts for any number of
+// clients, so a render costs a round trip instead of a process start. Each
+// connection carries a sequence of requests, each answered in turn:
+//
+//   request:  u8 kind | u8 input format | u8 output format | u8 flags | u32 size | size bytes
+//   response: u8 status | u8 0 | u8 0 | u8 0 | u32 size | size bytes
+//
+// Sizes are little-endian. Kind 0 sends the source itself, kind 1 a path for
+// the server to read, whose extension then decides the input format. Formats
+// are 0 EML, 1 HTML, 2 XML, 3 EMLB, as in libemlc.h. Flag 1 asks for minified
+// output. Status 0 is followed by the output, status 1 by an error message.
+//
+// One thread polls the socket and the idle connections. A connection with a
+// request waiting goes to a pool of workers, each with its own Converter; the
+// worker answers that one request and hands the connection back. Idle clients
+// therefore cost no worker, and one client's burst does not starve the rest.
+enum RequestKind { REQUEST_SOURCE, REQUEST_PATH };
+enum RequestFlag { REQUEST_MINIFY = 1 };
+
+class Server {
+public:
+    static constexpr uint32_t MAX_REQUEST = 1u << 30;
+    static constexpr int READ_TIMEOUT_S = 10; // a client stalled mid-request is dropped
+
+    Server(string socket_path, unsigned threads, size_t cache_bytes)
+        : socket_path(std::move(socket_path)),
+          threads(threads ? threads : max(1u, thread::hardware_concurrency())),
+          cache(cache_bytes) {}
+
+    // Serve until SIGINT or SIGTERM
+    int run() {
+#ifdef EMLC_POSIX_IO
+        string error;
+        if (!listen_on(error) || !open_wake_pipe(error)) {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+        signal_fd = wake[1];
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        signal(SIGPIPE, SIG_IGN); // a client that hangs up mid-reply is only a failed write
+
+        vector<thread> pool;
+        for (unsigned w = 0; w < threads; ++w) pool.emplace_back([this] { work(); });
+        cout << "Serving on " << socket_path << " with " << threads << (threads == 1 ? " thread" : " threads")
+             << " (Ctrl+C to stop)" << endl;
+
+        poll_loop();
+
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        has_work.notify_all();
+        for (auto& t : pool) t.join();
+        for (int fd : idle) ::close(fd);
+        for (int fd : returned) ::close(fd);
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+        ::close(wake[0]);
+        ::close(wake[1]);
+
+        cout << "Served " << requests << " requests (" << failures << " failed); cache: " << cache.hits
+             << " hits, " << cache.misses << " misses" << endl;
+        return 0;
+#else
+        cerr << "Error: --serve needs Unix-domain sockets (Linux or macOS)" << endl;
+        return 1;
+#endif
+    }
+
+private:
+    string socket_path;
+    unsigned threads;
+    ResultCache cache;
+    atomic<size_t> requests{0};
+    atomic<size_t> failures{0};
+
+#ifdef EMLC_POSIX_IO
+    int listen_fd = -1;
+    int wake[2] = {-1, -1}; // wakes the poll loop: a connection came back, or a signal
+    vector<int> idle;        // connections waiting for their next request; poll thread only
+
+    mutex lock;
+    condition_variable has_work;
+    deque<int> ready;     // connections with a request to read
+    vector<int> returned; // answered, for the poll loop to watch again
+    bool stopping = false;
+
+    static inline int signal_fd = -1;
+    static inline volatile sig_atomic_t stop_requested = 0;
+
+    static void on_signal(int) {
+        stop_requested = 1;
+        char c = 0;
+        (void)!::write(signal_fd, &c, 1);
+    }
+
+    static void set_flags(int fd, int flags) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (flags) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | flags);
+    }
+
+    bool listen_on(string& error) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.empty() || socket_path.size() >= sizeof(addr.sun_path)) {
+            error = "Socket path must be 1 to " + to_string(sizeof(addr.sun_path) - 1) + " bytes: " + socket_path;
+            return false;
+        }
+        memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+
+        listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            error = "Could not create socket";
+            return false;
+        }
+        set_flags(listen_fd, 0);
+        bool bound = ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        if (!bound && errno == EADDRINUSE) {
+            // Left behind by a server that did not shut down cleanly, unless one still answers on it
+            int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            bool live = ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+            ::close(probe);
+            if (live) {
+                error = "Another server is listening on " + socket_path;
+                return false;
+            }
+            ::unlink(socket_path.c_str());
+            bound = ::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        }
+        if (!bound) {
+            error = "Could not bind " + socket_path;
+            return false;
+        }
+        if (::listen(listen_fd, 128) != 0) {
+            error = "Could not listen on " + socket_path;
+            return false;
+        }
+        return true;
+    }
+
+    bool open_wake_pipe(string& error) {
+        if (::pipe(wake) != 0) {
+            error = "Could not create pipe";
+            return false;
+        }
+        set_flags(wake[0], O_NONBLOCK);
+        set_flags(wake[1], O_NONBLOCK);
+        return true;
+    }
+
+    void poll_loop() {
+        vector<pollfd> fds;
+        while (!stop_requested) {
+            fds.clear();
+            fds.push_back({listen_fd, POLLIN, 0});
+            fds.push_back({wake[0], POLLIN, 0});
+            for (int fd : idle) fds.push_back({fd, POLLIN, 0});
+            if (::poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                cerr << "Error: Could not poll connections" << endl;
+                return;
+            }
+
+            // Drain the wakeups before taking the returned connections: a worker
+            // that returns one later also writes a later wakeup
+            if (fds[1].revents) {
+                char buf[256];
+                while (::read(wake[0], buf, sizeof(buf)) > 0) {}
+            }
+
+            // Connections with a request (or a hangup) waiting go to the workers
+            vector<int> still_idle;
+            size_t handed = 0;
+            {
+                lock_guard<mutex> guard(lock);
+                for (size_t i = 2; i < fds.size(); ++i) {
+                    if (fds[i].revents) {
+                        ready.push_back(fds[i].fd);
+                        handed++;
+                    } else {
+                        still_idle.push_back(fds[i].fd);
+                    }
+                }
+                still_idle.insert(still_idle.end(), returned.begin(), returned.end());
+                returned.clear();
+            }
+            idle = std::move(still_idle);
+            if (handed) has_work.notify_all();
+
+            if (fds[0].revents & POLLIN) {
+                int fd = ::accept(listen_fd, nullptr, nullptr);
+                if (fd >= 0) {
+                    set_flags(fd, 0);
+                    timeval timeout = {READ_TIMEOUT_S, 0};
+                    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                    idle.push_back(fd);
+                }
+            }
+        }
+    }
+
+    void work() {
+        Converter converter;
+        StringSink out;
+        string body;
+        while (true) {
+            int fd;
+            {
+                unique_lock<mutex> guard(lock);
+                has_work.wait(guard, [this] { return stopping || !ready.empty(); });
+                if (ready.empty()) return;
+                fd = ready.front();
+                ready.pop_front();
+            }
+            if (!answer(fd, converter, out, body)) {
+                ::close(fd);
+                continue;
+            }
+            {
+                lock_guard<mutex> guard(lock);
+                returned.push_back(fd);
+            }
+            char c = 0;
+            (void)!::write(wake[1], &c, 1);
+        }
+    }
+
+    // Read one request from `fd` and reply to it. False when the connection is
+    // done: closed by the client, stalled, or unreadable.
+    bool answer(int fd, Converter& converter, StringSink& out, string& body) {
+        unsigned char header[8];
+        if (!read_all(fd, header, sizeof(header))) return false;
+        uint32_t size = load_le32(header + 4);
+        if (size > MAX_REQUEST) {
+            failures++;
+            reply(fd, 1, "Request too large");
+            return false; // the body can't be skipped reliably
+        }
+        body.resize(size);
+        if (!read_all(fd, body.data(), size)) return false;
+        requests++;
+
+        string error;
+        shared_ptr<const string> output;
+        try {
+            output = convert(RequestKind(header[0]), header[1], header[2], header[3], body, converter, out, error);
+        } catch (const exception& e) {
+            error = e.what();
+        }
+        if (!output) {
+            failures++;
+            return reply(fd, 1, error);
+        }
+        return reply(fd, 0, *output);
+    }
+
+    shared_ptr<const string> convert(RequestKind kind, unsigned from, unsigned to, unsigned flags, const string& body,
+                                     Converter& converter, StringSink& out, string& error) {
+        if (kind > REQUEST_PATH || from > FORMAT_EMLB || to > FORMAT_EMLB || (flags & ~unsigned(REQUEST_MINIFY))) {
+            error = "Bad request header";
+            return nullptr;
+        }
+        unique_ptr<SourceBuffer> file;
+        string_view input = body;
+        OutputFormat input_format = OutputFormat(from);
+        if (kind == REQUEST_PATH) {
+            file = load_input(body);
+            if (!file) {
+                error = "Could not open " + body;
+                return nullptr;
+            }
+            input = file->text();
+            input_format = output_format_for(body);
+        }
+
+        Hash128 key = ResultCache::key_for(input, input_format, OutputFormat(to), flags);
+        if (auto hit = cache.find(key)) return hit;
+        out.clear();
+        converter.output.minify = (flags & REQUEST_MINIFY) != 0;
+        converter.convert(input, input_format, OutputFormat(to), out);
+        auto output = make_shared<const string>(out.view());
+        cache.insert(key, output);
+        return output;
+    }
+
+    static uint32_t load_le32(const unsigned char* p) {
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+
+    static bool read_all(int fd, void* data, size_t n) {
+        char* p = static_cast<char*>(data);
+        while (n > 0) {
+            ssize_t r = ::read(fd, p, n);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            p += r;
+            n -= size_t(r);
+        }
+        return true;
+    }
+
+    static bool reply(int fd, unsigned char status, string_view payload) {
+        unsigned char header[8] = {status, 0, 0, 0};
+        uint32_t size = uint32_t(payload.size());
+        for (int i = 0; i < 4; ++i) header[4 + i] = (unsigned char)(size >> (8 * i));
+        FdSink out(fd, sizeof(header) + min<size_t>(payload.size(), 1 << 16));
+        out.write(string_view(reinterpret_cast<const char*>(header), sizeof(header)));
+        out.write(payload);
+        out.flush();
+        return out.ok();
+    }
+#endif
+};
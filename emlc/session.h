@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "eml.h"
+
+using namespace std;
+
+// ======================
+// Incremental Session
+// ======================
+// Keeps a parsed document in step with a text buffer that is being edited, for
+// editor integrations that reconvert on every keystroke. An edit re-reads only
+// the innermost element around it - the body of an EML {} block, or a whole
+// markup element - and keeps every other subtree as it was, shifting the source
+// ranges of what comes after. The result is always the tree a full parse of the
+// new text would give; when the parser cannot prove that for any element around
+// the edit (the block now closes somewhere else, the edit reaches outside every
+// element, ...) the session falls back to a full parse. An HTML element is
+// re-read with its ancestors open around it, so implied and stray end tags in
+// it resolve as they would in a full parse.
+//
+// Nodes of an untouched subtree keep pointing into whatever text they were
+// parsed from; the document's arena keeps those alive. A full parse is forced
+// now and then so the arena doesn't grow without bound.
+//
+// Moving the ranges of everything after an edit would touch most of the tree,
+// so it is done lazily: the later siblings of each element around the edit are
+// moved, and their descendants owe the same delta until an edit descends into
+// them or the tree is handed out.
+class EditSession {
+public:
+    size_t full_reparses = 0;    // edits (and the initial load) handled by parsing everything
+    size_t partial_reparses = 0; // edits handled by re-reading one element
+
+    // `html` parses markup with HTML's implied end tags (see Parser::html)
+    EditSession(string text, bool is_eml_format, bool html = false) : current(std::move(text)), is_eml(is_eml_format) {
+        parser.html = html;
+        full_reparse();
+    }
+
+    // Replace `removed` bytes at `offset` with `inserted`. Offsets past the end
+    // of the text are clamped to it.
+    void edit(size_t offset, size_t removed, string_view inserted) {
+        offset = min(offset, current.size());
+        removed = min(removed, current.size() - offset);
+        current.replace(offset, removed, inserted);
+        if (!reparse_around(offset, removed, inserted)) full_reparse();
+    }
+
+    Node* root() {
+        settle_all();
+        return doc.root;
+    }
+    string_view text() const { return current; }
+
+    // The subtree the last edit rebuilt, or null if it reparsed everything
+    Node* last_reparsed() {
+        settle_all();
+        return last;
+    }
+
+private:
+    string current;
+    bool is_eml;
+    Parser parser;
+    Document doc;
+    size_t unterminated_import = string::npos; // see Parser::first_unterminated_import
+    size_t reparsed_bytes = 0;                 // text copied into the arena since the last full parse
+    Node* last = nullptr;
+    unordered_map<Node*, ptrdiff_t> owed;      // node -> shift its descendants have yet to take
+
+    struct Step {
+        Node* node;
+        size_t index; // position in its parent's children
+    };
+
+    void full_reparse() {
+        doc = parser.parse(current, is_eml);
+        unterminated_import = parser.first_unterminated_import();
+        reparsed_bytes = 0;
+        last = nullptr;
+        owed.clear();
+        full_reparses++;
+    }
+
+    // Whether `n` is an element the edit of [offset, edit_end) lies within
+    // and that can be re-read on its own
+    bool encloses(const Node* n, size_t offset, size_t edit_end) const {
+        if (is_eml) {
+            // Inside the braces of a closed block
+            bool closed_block = n->body_begin != 0 && n->end > n->body_end;
+            return closed_block && n->body_begin <= offset && edit_end <= n->body_end;
+        }
+        // Past the '<' of the element; the reparse must show it still ends in the same place
+        return n->type == ELEMENT && n->begin < offset && edit_end <= n->end;
+    }
+
+    bool reparse_around(size_t offset, size_t removed, string_view inserted) {
+        // Start over once partial reparses have copied about twice the text
+        if (reparsed_bytes > 2 * current.size() + (1 << 16)) return false;
+
+        // An `import` that found no ';' would now reach one inserted after it
+        if (is_eml && inserted.find(';') != string_view::npos && unterminated_import < offset) return false;
+
+        ptrdiff_t delta = ptrdiff_t(inserted.size()) - ptrdiff_t(removed);
+        size_t edit_end = offset + removed; // old coordinates
+
+        // Elements around the edit, outermost first. Children are in source order
+        // and don't overlap, so only the last one starting before the edit can hold it.
+        vector<Step> path;
+        for (Node* node = doc.root;;) {
+            settle(node);
+            auto& kids = node->children;
+            auto it = upper_bound(kids.begin(), kids.end(), offset,
+                [](size_t off, const Node* n) { return off < n->begin; });
+            if (it == kids.begin() || !encloses(*(it - 1), offset, edit_end)) break;
+            node = *(it - 1);
+            path.push_back({node, size_t(it - 1 - kids.begin())});
+        }
+
+        // Innermost first; widen the scope when an element cannot be re-read alone
+        for (size_t k = path.size(); k-- > 0;) {
+            Node* target = path[k].node;
+            Node* parent = k > 0 ? path[k - 1].node : doc.root;
+            Node* rebuilt = nullptr;
+
+            if (is_eml) {
+                // The blocks around must stay markup without help from this block's content
+                if (parent != doc.root && !BlockIndex::header_marks_parent(current, target->begin, target->body_begin - 1)) continue;
+                size_t expected_close = size_t(ptrdiff_t(target->body_end) + delta);
+                if (!parser.reparse_eml_block(doc, current, target, target->body_begin - 1, expected_close)) continue;
+                rebuilt = target;
+                rebase(target, target->body_begin, target->body_end);
+            } else {
+                // In HTML the start tag's name decides which open elements before it end
+                if (parser.html && offset <= target->begin + 1 + target->tag.text().size()) continue;
+                size_t expected_end = size_t(ptrdiff_t(target->end) + delta);
+                vector<const Node*> ancestors;
+                for (size_t level = 0; level < k; ++level) ancestors.push_back(path[level].node);
+                rebuilt = parser.reparse_markup_element(doc, current, target->begin, expected_end, ancestors);
+                if (!rebuilt) continue;
+                parent->children[path[k].index] = rebuilt;
+                rebase(rebuilt, rebuilt->begin, rebuilt->end);
+            }
+
+            // Everything after the edit moves by delta; the elements around it grow
+            for (size_t level = k + 1; level-- > 0;) {
+                Node* around = level > 0 ? path[level - 1].node : doc.root;
+                auto& kids = around->children;
+                for (size_t i = path[level].index + 1; i < kids.size(); ++i) shift(kids[i], delta);
+                around->end += delta;
+                if (around->body_begin != 0) around->body_end += delta;
+            }
+
+            if (unterminated_import != string::npos && unterminated_import >= offset) unterminated_import += delta;
+            unterminated_import = min(unterminated_import, parser.first_unterminated_import());
+            reparsed_bytes += rebuilt->end - rebuilt->begin;
+            partial_reparses++;
+            last = rebuilt;
+            return true;
+        }
+        return false;
+    }
+
+    // Move one node's ranges; its descendants owe the delta
+    void shift(Node* n, ptrdiff_t delta) {
+        if (delta == 0) return;
+        n->begin += delta;
+        n->end += delta;
+        if (n->body_begin != 0) {
+            n->body_begin += delta;
+            n->body_end += delta;
+        }
+        if (!n->children.empty()) owed[n] += delta;
+    }
+
+    // Pay what `n`'s children owe, passing their own descendants' share down
+    void settle(Node* n) {
+        auto it = owed.find(n);
+        if (it == owed.end()) return;
+        ptrdiff_t delta = it->second;
+        owed.erase(it);
+        for (Node* child : n->children) shift(child, delta);
+    }
+
+    void settle_all() {
+        while (!owed.empty()) settle(owed.begin()->first);
+    }
+
+    // Views a reparse left pointing into `current` move to a copy in the arena,
+    // so the text can keep changing under them
+    void rebase(Node* top, size_t begin, size_t end) {
+        const char* lo = current.data() + begin;
+        const char* hi = current.data() + end;
+        const char* copy = doc.store(string_view(current).substr(begin, end - begin)).data();
+        auto move = [&](StrRef& s) {
+            if (less_equal<const char*>()(lo, s.data()) && less_equal<const char*>()(s.data() + s.size(), hi)) {
+                s = StrRef(copy + (s.data() - lo), s.size());
+            }
+        };
+
+        vector<Node*> stack = {top};
+        while (!stack.empty()) {
+            Node* n = stack.back();
+            stack.pop_back();
+            move(n->content);
+            for (auto& attr : n->attrs) {
+                move(attr.value);
+                move(attr.separator);
+            }
+            stack.insert(stack.end(), n->children.begin(), n->children.end());
+        }
+    }
+};
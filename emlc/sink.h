@@ -0,0 +1,230 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+// ======================
+// Output Sinks
+// ======================
+// Formatters write their output straight into a Sink in one pass. Writes go
+// into a buffer with a plain memcpy; only when it fills up does the sink hand
+// the bytes on (grow, write(2), callback).
+class Sink {
+public:
+    virtual ~Sink() {}
+
+    void write(string_view s) {
+        if (s.size() <= size_t(end - cur)) {
+            memcpy(cur, s.data(), s.size());
+            cur += s.size();
+            return;
+        }
+        overflow(s);
+    }
+
+    void put(char c) {
+        if (cur == end) overflow(string_view(&c, 1));
+        else *cur++ = c;
+    }
+
+    // Write `n` copies of `c`
+    void fill(char c, size_t n) {
+        while (n > 0) {
+            if (cur == end) overflow(string_view());
+            size_t k = min(n, size_t(end - cur));
+            memset(cur, c, k);
+            cur += k;
+            n -= k;
+        }
+    }
+
+    // Push buffered bytes to their destination
+    virtual void flush() {}
+
+    bool ok() const { return !failed; }
+
+protected:
+    char* cur = nullptr;
+    char* end = nullptr;
+    bool failed = false;
+
+    // Called when `s` does not fit in [cur, end). Must consume `s` and leave
+    // room for at least one more byte.
+    virtual void overflow(string_view s) = 0;
+};
+
+// Growable in-memory buffer
+class StringSink : public Sink {
+public:
+    explicit StringSink(size_t reserve = 4096) {
+        buf.resize(max<size_t>(reserve, 64));
+        cur = buf.data();
+        end = buf.data() + buf.size();
+    }
+
+    size_t size() const { return size_t(cur - buf.data()); }
+    string_view view() const { return string_view(buf.data(), size()); }
+
+    // Drop the output but keep the buffer, for the next document
+    void clear() { cur = buf.data(); }
+
+    // Move the output out; the sink is left empty
+    string take() {
+        buf.resize(size());
+        string out = std::move(buf);
+        buf.assign(64, '\0');
+        cur = buf.data();
+        end = buf.data() + buf.size();
+        return out;
+    }
+
+protected:
+    void overflow(string_view s) override {
+        size_t used = size();
+        buf.resize(max(buf.size() * 2, used + s.size() + 64));
+        memcpy(buf.data() + used, s.data(), s.size());
+        cur = buf.data() + used + s.size();
+        end = buf.data() + buf.size();
+    }
+
+private:
+    string buf;
+};
+
+// Fixed-size staging buffer drained in large chunks
+class BufferedSink : public Sink {
+public:
+    explicit BufferedSink(size_t buffer_size = 1 << 16) : buf(max<size_t>(buffer_size, 64)) {
+        cur = buf.data();
+        end = buf.data() + buf.size();
+    }
+
+    // When set, the time spent draining is added to it (--stats)
+    double* drain_ms = nullptr;
+
+    void flush() override {
+        if (cur != buf.data()) {
+            drained += size_t(cur - buf.data());
+            timed([&] { drain(buf.data(), size_t(cur - buf.data())); });
+        }
+        cur = buf.data();
+    }
+
+    // Bytes written so far, drained or still staged
+    size_t bytes_written() const { return drained + size_t(cur - buf.data()); }
+
+protected:
+    virtual void drain(const char* data, size_t n) = 0;
+
+    // Drain the staged bytes followed by a chunk too big to stage
+    virtual void drain_both(string_view staged, string_view big) {
+        if (!staged.empty()) drain(staged.data(), staged.size());
+        drain(big.data(), big.size());
+    }
+
+    void overflow(string_view s) override {
+        if (s.size() >= buf.size()) {
+            // too big to stage, pass straight through
+            drained += size_t(cur - buf.data()) + s.size();
+            timed([&] { drain_both(string_view(buf.data(), size_t(cur - buf.data())), s); });
+            cur = buf.data();
+            return;
+        }
+        flush();
+        memcpy(cur, s.data(), s.size());
+        cur += s.size();
+    }
+
+private:
+    vector<char> buf;
+    size_t drained = 0;
+
+    template <class F>
+    void timed(F f) {
+        if (!drain_ms) return f();
+        auto t0 = chrono::steady_clock::now();
+        f();
+        *drain_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+    }
+};
+
+// Writes to an open file descriptor. The descriptor is not closed.
+class FdSink : public BufferedSink {
+public:
+    explicit FdSink(int fd, size_t buffer_size = 1 << 16) : BufferedSink(buffer_size), fd(fd) {}
+    ~FdSink() override { flush(); }
+
+protected:
+    void drain(const char* data, size_t n) override {
+        while (n > 0 && !failed) {
+#ifdef _WIN32
+            int w = _write(fd, data, (unsigned)min<size_t>(n, 1u << 30));
+#else
+            ssize_t w = ::write(fd, data, n);
+#endif
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                failed = true;
+                return;
+            }
+            data += w;
+            n -= size_t(w);
+        }
+    }
+
+#ifndef _WIN32
+    // One writev(2) for the staged bytes and the large chunk behind them
+    void drain_both(string_view staged, string_view big) override {
+        iovec iov[2] = {
+            {const_cast<char*>(staged.data()), staged.size()},
+            {const_cast<char*>(big.data()), big.size()},
+        };
+        int i = staged.empty() ? 1 : 0;
+        while (i < 2 && !failed) {
+            ssize_t w = ::writev(fd, iov + i, 2 - i);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                failed = true;
+                return;
+            }
+            size_t n = size_t(w);
+            while (i < 2 && n >= iov[i].iov_len) n -= iov[i++].iov_len;
+            if (i < 2) {
+                iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
+                iov[i].iov_len -= n;
+            }
+        }
+    }
+#endif
+
+    int fd;
+};
+
+// Hands each buffered chunk to a user callback
+class CallbackSink : public BufferedSink {
+public:
+    explicit CallbackSink(function<void(string_view)> fn, size_t buffer_size = 1 << 16)
+        : BufferedSink(buffer_size), fn(std::move(fn)) {}
+    ~CallbackSink() override { flush(); }
+
+protected:
+    void drain(const char* data, size_t n) override { fn(string_view(data, n)); }
+
+private:
+    function<void(string_view)> fn;
+};
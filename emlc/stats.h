@@ -0,0 +1,170 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+#include "eml.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// ======================
+// Conversion Statistics
+// ======================
+// What --stats reports: where the time of each conversion went and what the
+// input looked like. A Converter only measures when it has a ConvertStats to
+// fill; without one it takes no timestamps, walks no trees and counts nothing.
+// Phase times of a batch are summed over its threads.
+struct ConvertStats {
+    size_t files = 0;
+    size_t cache_hits = 0; // files whose output came from the cache, not parsed
+    size_t bytes_in = 0;
+    size_t bytes_out = 0;
+
+    // Wall time per phase, ms
+    double read_ms = 0;
+    double parse_ms = 0;
+    double format_ms = 0;
+    double write_ms = 0;
+
+    size_t nodes[WHITESPACE + 1] = {}; // by NodeType
+    size_t max_depth = 0;              // top-level nodes are at depth 1
+    BlockStats blocks;                 // EML {} blocks
+    size_t arena_bytes = 0;            // heap taken by the documents' arenas
+    size_t arena_allocations = 0;
+
+    // Count the nodes of a parsed tree by type, and its depth
+    void count_tree(Node* root) {
+        struct Item {
+            Node* node;
+            size_t depth;
+        };
+        vector<Item> stack;
+        for (Node* child : root->children) stack.push_back({child, 1});
+        while (!stack.empty()) {
+            Item item = stack.back();
+            stack.pop_back();
+            nodes[item.node->type]++;
+            max_depth = max(max_depth, item.depth);
+            for (Node* child : item.node->children) stack.push_back({child, item.depth + 1});
+        }
+    }
+
+    void count_document(const Document& doc) {
+        count_tree(doc.root);
+        arena_bytes += doc.arena_bytes();
+        arena_allocations += doc.arena_allocations();
+    }
+
+    void add(const ConvertStats& o) {
+        files += o.files;
+        cache_hits += o.cache_hits;
+        bytes_in += o.bytes_in;
+        bytes_out += o.bytes_out;
+        read_ms += o.read_ms;
+        parse_ms += o.parse_ms;
+        format_ms += o.format_ms;
+        write_ms += o.write_ms;
+        for (size_t t = 0; t <= WHITESPACE; ++t) nodes[t] += o.nodes[t];
+        max_depth = max(max_depth, o.max_depth);
+        blocks.add(o.blocks);
+        arena_bytes += o.arena_bytes;
+        arena_allocations += o.arena_allocations;
+    }
+
+    size_t total_nodes() const {
+        size_t n = 0;
+        for (size_t count : nodes) n += count;
+        return n;
+    }
+
+    void print(ostream& out) const {
+        out << "Stats: " << files << (files == 1 ? " file" : " files");
+        if (cache_hits) out << " (" << cache_hits << " from cache)";
+        out << ", " << bytes_in << " bytes in, " << bytes_out << " bytes out" << endl;
+        out << "  time      read " << read_ms << " ms, parse " << parse_ms << " ms, format " << format_ms
+            << " ms, write " << write_ms << " ms" << endl;
+        out << "  nodes     " << total_nodes();
+        const char* sep = " (";
+        for (size_t t = 0; t <= WHITESPACE; ++t) {
+            if (!nodes[t]) continue;
+            out << sep << NODE_TYPE_NAMES[t] << ' ' << nodes[t];
+            sep = ", ";
+        }
+        out << (total_nodes() ? ")" : "") << ", max depth " << max_depth << endl;
+        out << "  blocks    " << blocks.syntax_probes << " syntax probes: " << blocks.nested << " parsed as elements, "
+            << blocks.text << " as text; " << blocks.raw << " raw" << endl;
+        out << "  memory    " << arena_bytes << " bytes of arena in " << arena_allocations << " allocations, peak RSS "
+            << peak_rss_bytes() << " bytes" << endl;
+    }
+
+    void print_json(ostream& out) const {
+        out << "{\"files\": " << files << ", \"cache_hits\": " << cache_hits << ", \"bytes_in\": " << bytes_in
+            << ", \"bytes_out\": " << bytes_out << "," << endl;
+        out << " \"time_ms\": {\"read\": " << read_ms << ", \"parse\": " << parse_ms << ", \"format\": " << format_ms
+            << ", \"write\": " << write_ms << "}," << endl;
+        out << " \"nodes\": {";
+        for (size_t t = 0; t <= WHITESPACE; ++t) {
+            out << (t ? ", " : "") << '"' << NODE_TYPE_NAMES[t] << "\": " << nodes[t];
+        }
+        out << "}, \"max_depth\": " << max_depth << "," << endl;
+        out << " \"blocks\": {\"syntax_probes\": " << blocks.syntax_probes << ", \"nested\": " << blocks.nested
+            << ", \"text\": " << blocks.text << ", \"raw\": " << blocks.raw << "}," << endl;
+        out << " \"arena_bytes\": " << arena_bytes << ", \"arena_allocations\": " << arena_allocations
+            << ", \"peak_rss_bytes\": " << peak_rss_bytes() << "}" << endl;
+    }
+
+    // Peak resident set size of the whole process so far, or 0 if unknown
+    static size_t peak_rss_bytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS pmc;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return size_t(pmc.PeakWorkingSetSize);
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+        return size_t(usage.ru_maxrss); // bytes
+#else
+        return size_t(usage.ru_maxrss) * 1024; // KiB
+#endif
+#endif
+    }
+
+    static constexpr const char* NODE_TYPE_NAMES[] = {
+        "element", "text", "comment", "comment_block", "pi", "import", "whitespace"
+    };
+};
+
+// Adds the time since the previous lap to one phase of a ConvertStats; does
+// nothing (not even read the clock) without one
+class PhaseClock {
+public:
+    explicit PhaseClock(ConvertStats* stats) : stats(stats) {
+        if (stats) last = chrono::steady_clock::now();
+    }
+
+    void lap(double ConvertStats::*phase) {
+        if (!stats) return;
+        auto now = chrono::steady_clock::now();
+        stats->*phase += chrono::duration<double, milli>(now - last).count();
+        last = now;
+    }
+
+private:
+    ConvertStats* stats;
+    chrono::steady_clock::time_point last;
+};
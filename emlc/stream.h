@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "eml.h"
+#include "files.h"
+
+using namespace std;
+
+// ======================
+// Streaming Decompiler
+// ======================
+// HTML or XML to EML without the document in memory. The input is read in
+// chunks into a window, and each text run, comment, PI or tag is written out
+// as soon as its place in the output is known; the window keeps only what has
+// not been read yet. Open elements are frames holding their tag and attributes
+// copied out of the window. An element's first child is held back while it is
+// text, until the next child or the end tag tells whether it goes inline.
+// Memory is bounded by the nesting depth plus the largest single tag or text
+// run, whatever the size of the document.
+//
+// The markup is read by the rules of Parser's markup path and every node is
+// written by EmlFormatter, so the output is the same as formatting the tree
+// Parser builds from the whole document.
+class StreamDecompiler {
+public:
+    bool html = false;                   // read with HTML rules (see Parser::html)
+    size_t chunk_size = size_t(1) << 20; // the window, until a single token needs more
+
+    // Read all of `in` and write it to `out` as EML. False if reading fails.
+    bool decompile(InputStream& in, Sink& out) {
+        window.assign(max<size_t>(chunk_size, 16), '\0');
+        filled = pos = 0;
+        at_end = false;
+        depth = 0;
+        end_candidates.clear();
+        frame(0).node.tag = ATOM_ROOT;
+        while (true) {
+            Step s = step(out);
+            if (s == STEP_DONE) break;
+            if (s == STEP_MORE) refill(in);
+        }
+        return !in.failed;
+    }
+
+private:
+    enum Step {
+        STEP_OK,   // a token was read
+        STEP_MORE, // the next token runs past the window
+        STEP_DONE  // the document has ended
+    };
+
+    // What an open element has written so far
+    enum State {
+        EMPTY, // nothing: no children yet
+        HELD,  // nothing: its only child so far is text, in `held`
+        OPEN   // its start line, "tag (...) {"
+    };
+
+    struct Frame {
+        Node node{ELEMENT, pmr::new_delete_resource()}; // tag and attributes; children only while being written
+        string text;             // attribute values and names that are not built in
+        vector<AtomEntry> names; // atoms for those names
+        Node held{TEXT, pmr::new_delete_resource()};
+        string held_text;
+        State state = EMPTY;
+        int indent = 0; // the element's own level
+        int inner = 0;  // its children's (see Formatter::inner_indent)
+    };
+
+    // A start tag read from the window but not acted on yet
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+    struct AttrRange {
+        Range key;
+        Range value;
+    };
+
+    string window; // [0, filled) read from the input; [pos, filled) not parsed yet
+    size_t filled = 0;
+    size_t pos = 0;
+    bool at_end = false; // the input has no more after `filled`
+
+    vector<unique_ptr<Frame>> frames; // [0] is the root, [1, depth] the open elements
+    size_t depth = 0;
+    vector<size_t> end_candidates; // HTML: depths of open elements with TAG_OPTIONAL_CLOSE or TAG_SCOPE
+    Frame leaf;                              // a void or self-closing element being written
+    Node scratch{TEXT, pmr::null_memory_resource()}; // a text, comment or PI being written
+    EmlFormatter eml;
+
+    Range tag{0, 0};
+    vector<AttrRange> attrs;
+    bool self_closing = false;
+
+    Frame& frame(size_t i) {
+        while (frames.size() <= i) frames.push_back(make_unique<Frame>());
+        return *frames[i];
+    }
+
+    // Drop what has been parsed and read more behind the rest. A token that
+    // fills over half the window doubles it, so a huge one is only scanned
+    // again a few times.
+    void refill(InputStream& in) {
+        size_t kept = filled - pos;
+        memmove(window.data(), window.data() + pos, kept);
+        filled = kept;
+        pos = 0;
+        if (kept > window.size() / 2) window.resize(window.size() * 2);
+        while (filled < window.size()) {
+            size_t n = in.read(window.data() + filled, window.size() - filled);
+            if (n == 0) {
+                at_end = true;
+                break;
+            }
+            filled += n;
+        }
+    }
+
+    // Read and write the next token (see Parser::next_markup_event)
+    Step step(Sink& out) {
+        string_view input(window.data(), filled);
+        size_t len = filled;
+        if (pos == len) {
+            if (!at_end) return STEP_MORE;
+            if (depth == 0) return STEP_DONE;
+            close_innermost(input, out);
+            return STEP_OK;
+        }
+
+        size_t lt = scan<TagStart>(input, pos);
+        if (lt == len && !at_end) return STEP_MORE;
+        if (lt > pos) {
+            add_text(input.substr(pos, lt - pos), out);
+            pos = lt;
+            return STEP_OK;
+        }
+
+        if (len - pos < 4 && !at_end) return STEP_MORE; // enough to tell a comment, PI or end tag
+        if (input.compare(pos, 4, "<!--") == 0) {
+            size_t end = input.find("-->", pos);
+            if (end == string::npos && !at_end) return STEP_MORE;
+            if (end == string::npos) end = len;
+            set_scratch(COMMENT, end > pos + 4 ? trim(input.substr(pos + 4, end - (pos + 4))) : StrRef());
+            add_leaf(&scratch, out);
+            pos = end == len ? len : end + 3;
+            return STEP_OK;
+        }
+
+        if (input.compare(pos, 2, "<?") == 0) {
+            size_t end = input.find("?>", pos);
+            if (end == string::npos && !at_end) return STEP_MORE;
+            if (end == string::npos) end = len;
+            string_view raw = input.substr(pos + 2, end > pos + 2 ? end - (pos + 2) : 0);
+            if (raw.substr(0, 3) == "php") {
+                set_scratch(PI, raw.substr(3));
+                scratch.tag = ATOM_PHP;
+            } else if (raw.substr(0, 7) == "import ") {
+                set_scratch(IMPORT, raw.substr(7));
+            } else {
+                set_scratch(PI, raw);
+                scratch.tag = ATOM_XML;
+            }
+            add_leaf(&scratch, out);
+            pos = end == len ? len : end + 2;
+            return STEP_OK;
+        }
+
+        if (pos + 1 < len && input[pos + 1] == '/') {
+            size_t gt = input.find('>', pos);
+            if (gt == string::npos && !at_end) return STEP_MORE;
+            if (html && depth > 0) {
+                // HTML closes every element inside the one named, at once
+                string_view name = input.substr(pos + 2, scan<NameEnd>(input, pos + 2) - (pos + 2));
+                size_t match = depth;
+                while (match > 0 && frames[match]->node.tag.text() != name) --match;
+                if (match > 0) {
+                    while (depth >= match) close_innermost(input, out);
+                    return STEP_OK;
+                }
+            }
+            if (html) {
+                // A stray end tag with nothing to close is dropped
+                pos = gt == string::npos ? len : gt + 1;
+                return STEP_OK;
+            }
+            if (depth == 0) return STEP_DONE; // an XML end tag that nothing opened ends the document
+            close_innermost(input, out);
+            return STEP_OK;
+        }
+
+        size_t end = read_start_tag(input);
+        if (end == len && !at_end) return STEP_MORE;
+        string_view name = input.substr(tag.begin, tag.end - tag.begin);
+        if (html) {
+            while (ends_open_element(name)) close_innermost(input, out);
+        }
+        const AtomEntry* builtin = BUILTIN_ATOMS.find(name, atom_hash(name));
+        bool has_body = !self_closing && !(builtin && (builtin->flags & TAG_VOID));
+        Frame& el = has_body ? frame(depth + 1) : leaf;
+        keep_start_tag(el, input);
+        pos = end;
+        if (!has_body) {
+            el.node.children.clear();
+            el.node.explicit_empty_block = false;
+            add_leaf(&el.node, out);
+            return STEP_OK;
+        }
+        if (depth > 0) start_children(*frames[depth], &el.node, out);
+        el.state = EMPTY;
+        el.indent = frames[depth]->inner;
+        el.inner = el.node.tag == ATOM_ROOT ? el.indent : el.indent + 1;
+        depth++;
+        if (html && el.node.tag.is(AtomFlag(TAG_OPTIONAL_CLOSE | TAG_SCOPE))) end_candidates.push_back(depth);
+        return STEP_OK;
+    }
+
+    // Text between tags (see Parser::markup_text)
+    void add_text(string_view text, Sink& out) {
+        if (trim(text).empty()) {
+            if (std::count(text.begin(), text.end(), '\n') == 0) return;
+            set_scratch(WHITESPACE, text);
+        } else {
+            set_scratch(TEXT, text);
+        }
+        add_leaf(&scratch, out);
+    }
+
+    void set_scratch(NodeType type, string_view content) {
+        scratch.type = type;
+        scratch.tag = Atom();
+        scratch.content = StrRef(content);
+    }
+
+    // A node with nothing inside it arrives in the innermost open element:
+    // held back if it may be that element's only text, else written
+    void add_leaf(Node* node, Sink& out) {
+        if (depth > 0) {
+            Frame& parent = *frames[depth];
+            if (parent.state == EMPTY && node->type == TEXT) {
+                parent.held_text.assign(node->content);
+                parent.held.content = StrRef(parent.held_text);
+                parent.state = HELD;
+                return;
+            }
+            start_children(parent, node, out);
+        }
+        eml.open(node, out, frames[depth]->inner);
+    }
+
+    // `parent` gets a child that is not its only text: write its start line,
+    // and the text held before it
+    void start_children(Frame& parent, Node* next, Sink& out) {
+        if (parent.state == OPEN) return;
+        int indent = parent.indent;
+        parent.node.children.clear();
+        if (parent.state == HELD) parent.node.children.push_back(&parent.held);
+        parent.node.children.push_back(next);
+        parent.node.explicit_empty_block = false;
+        eml.open(&parent.node, out, indent);
+        if (parent.state == HELD) eml.open(&parent.held, out, parent.inner);
+        parent.state = OPEN;
+    }
+
+    // End the innermost open element, consuming its end tag when `pos` is at
+    // one that names it (see Parser::close_markup_element)
+    void close_innermost(string_view input, Sink& out) {
+        Frame& el = *frames[depth];
+        if (input.compare(pos, 2, "</") == 0) {
+            size_t name_end = scan<NameEnd>(input, pos + 2);
+            if (input.substr(pos + 2, name_end - (pos + 2)) == el.node.tag.text()) {
+                size_t gt = input.find('>', name_end);
+                pos = gt == string::npos ? input.size() : gt + 1;
+            }
+        }
+
+        int indent = el.indent;
+        if (el.state == EMPTY) {
+            el.node.children.clear();
+            el.node.explicit_empty_block = true;
+            eml.open(&el.node, out, indent);
+        } else if (el.state == HELD) {
+            el.node.children.assign(1, &el.held);
+            el.node.explicit_empty_block = false;
+            if (eml.open(&el.node, out, indent)) {
+                eml.open(&el.held, out, el.inner);
+                eml.close(&el.node, out, indent);
+            }
+        } else {
+            eml.close(&el.node, out, indent);
+        }
+        if (!end_candidates.empty() && end_candidates.back() == depth) end_candidates.pop_back();
+        depth--;
+    }
+
+    // Whether start tag `next` ends an open element (see Parser::ends_open_element)
+    bool ends_open_element(string_view next) const {
+        for (auto i = end_candidates.rbegin(); i != end_candidates.rend(); ++i) {
+            Atom tag = frames[*i]->node.tag;
+            if (tag.is(TAG_OPTIONAL_CLOSE) && implies_end_tag(tag.text(), next)) return true;
+            if (tag.is(TAG_SCOPE) && bounds_implied_end(tag.text(), next)) return false;
+        }
+        return false;
+    }
+
+    // Read the start tag at `pos` into `tag`, `attrs` and `self_closing`
+    // without acting on it (see Parser::read_start_tag). Returns where it
+    // ends; at the end of the window it may have been cut short.
+    size_t read_start_tag(string_view input) {
+        size_t len = input.size();
+        size_t p = pos + 1;
+        auto peek = [&] { return p < len ? input[p] : '\0'; };
+        tag = {p, scan<NameEnd>(input, p)};
+        p = tag.end;
+        attrs.clear();
+        while (p < len && peek() != '>' && peek() != '/') {
+            p = scan<SpaceEnd>(input, p);
+            if (!is_ident_start(peek())) {
+                if (peek() == '>' || peek() == '/') break;
+                if (p < len) p++;
+                continue;
+            }
+            Range key{p, scan<NameEnd>(input, p)};
+            p = scan<SpaceEnd>(input, key.end);
+            Range value{p, p};
+            if (peek() == '=') {
+                p = scan<SpaceEnd>(input, p + 1);
+                char q = peek();
+                if (q == '"' || q == '\'') {
+                    p++;
+                    value.begin = p;
+                    p = q == '"' ? scan<QuoteEnd<'"'>>(input, p) : scan<QuoteEnd<'\''>>(input, p);
+                    value.end = p;
+                    if (p < len) p++;
+                } else {
+                    value = {p, scan<BareValueEnd>(input, p)};
+                    p = value.end;
+                }
+            }
+            attrs.push_back({key, value});
+        }
+        self_closing = peek() == '/';
+        if (self_closing) p++;
+        if (peek() == '>') p++;
+        return p;
+    }
+
+    // Copy the start tag just read out of the window into `el`
+    void keep_start_tag(Frame& el, string_view input) {
+        size_t bytes = tag.end - tag.begin;
+        for (const auto& a : attrs) bytes += (a.key.end - a.key.begin) + (a.value.end - a.value.begin);
+        el.text.clear();
+        el.text.reserve(bytes); // no reallocation below: views into it stay valid
+        el.names.clear();
+        el.names.reserve(1 + attrs.size());
+        auto keep = [&](Range r) {
+            size_t at = el.text.size();
+            el.text.append(input.substr(r.begin, r.end - r.begin));
+            return StrRef(string_view(el.text).substr(at));
+        };
+        auto atom = [&](Range r) {
+            string_view name = input.substr(r.begin, r.end - r.begin);
+            if (const AtomEntry* e = BUILTIN_ATOMS.find(name, atom_hash(name))) return Atom(e);
+            el.names.push_back({keep(r), 0});
+            return Atom(&el.names.back());
+        };
+        el.node.tag = atom(tag);
+        el.node.attrs.clear();
+        for (const auto& a : attrs) {
+            Atom key = atom(a.key);
+            el.node.attrs.push_back({key, keep(a.value), StrRef(" ")});
+        }
+    }
+};
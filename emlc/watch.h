@@ -0,0 +1,220 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// ======================
+// Watch Mode
+// ======================
+// Stays resident after the first build and recompiles inputs as they change.
+// Directories are watched rather than single files so editors that save by
+// writing a temp file and renaming it over the original are still seen. Events
+// are debounced: a burst of writes (save-all, git checkout) collects into one
+// rebuild once the directories have been quiet for `debounce`.
+class Watcher {
+public:
+    Watcher(vector<BatchJob> jobs, optional<TreeMapping> tree, chrono::milliseconds debounce, BuildCache* cache = nullptr,
+            const OutputOptions& output = {})
+        : tree(std::move(tree)), debounce(debounce) {
+        for (auto& job : jobs) add_job(std::move(job));
+        converter.cache = cache;
+        converter.output = output;
+    }
+
+    // Watch until interrupted. Returns only if watching could not be set up.
+    int run() {
+#ifdef __linux__
+        fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (fd < 0) {
+            cerr << "Error: Could not start inotify" << endl;
+            return 1;
+        }
+        if (tree) {
+            watch_tree(tree->input_dir);
+        } else {
+            for (const auto& entry : by_input) watch_dir(parent_dir(entry.first));
+        }
+        if (watched.empty()) {
+            cerr << "Error: Nothing to watch" << endl;
+            return 1;
+        }
+        cout << "Watching " << by_input.size() << (by_input.size() == 1 ? " file" : " files")
+             << " in " << watched.size() << (watched.size() == 1 ? " directory" : " directories")
+             << " (Ctrl+C to stop)" << endl;
+
+        // A steady stream of writes must not postpone the rebuild forever
+        const auto max_delay = max(debounce * 10, chrono::milliseconds(250));
+        set<string> pending;
+        auto first_event = chrono::steady_clock::now();
+        auto last_event = first_event;
+
+        while (true) {
+            int timeout = -1;
+            if (!pending.empty()) {
+                auto now = chrono::steady_clock::now();
+                auto due = min(last_event + debounce, first_event + max_delay);
+                timeout = int(max<long long>(0, chrono::duration_cast<chrono::milliseconds>(due - now).count()));
+            }
+
+            pollfd p = {fd, POLLIN, 0};
+            int ready = poll(&p, 1, timeout);
+            if (ready < 0 && errno != EINTR) {
+                cerr << "Error: Could not read file events" << endl;
+                return 1;
+            }
+            if (ready > 0) {
+                bool was_idle = pending.empty();
+                read_events(pending);
+                if (!pending.empty()) {
+                    last_event = chrono::steady_clock::now();
+                    if (was_idle) first_event = last_event;
+                }
+                continue;
+            }
+            if (!pending.empty()) {
+                rebuild(pending);
+                pending.clear();
+            }
+        }
+#else
+        cerr << "Error: --watch is only supported on Linux" << endl;
+        return 1;
+#endif
+    }
+
+private:
+    optional<TreeMapping> tree;
+    chrono::milliseconds debounce;
+    map<string, vector<BatchJob>> by_input; // normalized input path -> its conversions
+    Converter converter;                     // one resident pipeline for every rebuild
+
+#ifdef __linux__
+    int fd = -1;
+    unordered_map<int, filesystem::path> watched; // watch descriptor -> directory
+#endif
+
+    static string normalize(const filesystem::path& path) {
+        return path.lexically_normal().string();
+    }
+
+    static filesystem::path parent_dir(const string& file) {
+        filesystem::path dir = filesystem::path(file).parent_path();
+        return dir.empty() ? filesystem::path(".") : dir;
+    }
+
+    void add_job(BatchJob job) {
+        by_input[normalize(job.input)].push_back(std::move(job));
+    }
+
+    void rebuild(const set<string>& inputs) {
+        for (const auto& input : inputs) {
+            auto found = by_input.find(input);
+            if (found == by_input.end()) continue;
+            for (const auto& job : found->second) {
+                error_code ec;
+                filesystem::path parent = filesystem::path(job.output).parent_path();
+                if (!parent.empty()) filesystem::create_directories(parent, ec);
+
+                auto t0 = chrono::steady_clock::now();
+                string error;
+                if (!converter.convert(job.input, job.output, job.format, error)) {
+                    cerr << "Error: " << error << endl;
+                    continue;
+                }
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+                cout << "Converted " << job.input << " -> " << job.output << " (" << ms << " ms"
+                     << (converter.last_hit ? ", cached)" : ")") << endl;
+            }
+        }
+    }
+
+#ifdef __linux__
+    void watch_dir(const filesystem::path& dir) {
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+        if (wd < 0) {
+            cerr << "Error: Could not watch " << dir.string() << endl;
+            return;
+        }
+        watched[wd] = dir;
+    }
+
+    // Watch a directory and everything below it, skipping the output tree
+    void watch_tree(const filesystem::path& root) {
+        error_code ec;
+        watch_dir(root);
+        filesystem::recursive_directory_iterator it(root, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            if (!it->is_directory(ec)) continue;
+            if (filesystem::equivalent(it->path(), tree->output_dir, ec)) {
+                it.disable_recursion_pending();
+                continue;
+            }
+            watch_dir(it->path());
+        }
+    }
+
+    // A directory appeared inside the tree: watch it, and pick up files that
+    // were written into it before the watch existed
+    void adopt_dir(const filesystem::path& dir, set<string>& pending) {
+        error_code ec;
+        if (filesystem::equivalent(dir, tree->output_dir, ec)) return;
+        watch_tree(dir);
+        for (filesystem::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            if (it->is_regular_file(ec)) note_file(it->path(), pending);
+        }
+    }
+
+    void note_file(const filesystem::path& path, set<string>& pending) {
+        string key = normalize(path);
+        if (by_input.find(key) == by_input.end()) {
+            // New file in a watched tree gets its own conversion from now on
+            if (!tree || !tree->wants(path)) return;
+            add_job(tree->job_for(path));
+        }
+        pending.insert(key);
+    }
+
+    void read_events(set<string>& pending) {
+        alignas(inotify_event) char buf[64 * 1024];
+        while (true) {
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n <= 0) return; // drained (EAGAIN) or interrupted
+            for (char* p = buf; p < buf + n;) {
+                const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+                p += sizeof(inotify_event) + ev->len;
+
+                if (ev->mask & IN_IGNORED) {
+                    watched.erase(ev->wd); // directory was removed
+                    continue;
+                }
+                auto dir = watched.find(ev->wd);
+                if (dir == watched.end() || ev->len == 0) continue;
+                filesystem::path path = dir->second / ev->name;
+
+                if (ev->mask & IN_ISDIR) {
+                    if (tree && (ev->mask & (IN_CREATE | IN_MOVED_TO))) adopt_dir(path, pending);
+                } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    note_file(path, pending); // a bare IN_CREATE is followed by IN_CLOSE_WRITE
+                }
+            }
+        }
+    }
+#endif
+};
@@ -0,0 +1,23 @@
+#!/bin/sh
+# An output installed from the build cache is a hard link to its entry.
+# Rewriting that output without --cache must not write through into the
+# entry, or a later cache hit serves the rewritten bytes.
+set -e
+emlc="$1"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+echo 'div { Hello }' > a.eml
+"$emlc" a.eml a.html --cache c > /dev/null
+echo 'div { Changed }' > a.eml
+"$emlc" a.eml a.html > /dev/null
+echo 'div { Hello }' > a.eml
+"$emlc" a.eml b.html --cache c > /dev/null
+
+if ! grep -q Hello b.html; then
+    echo "cache entry was overwritten through an output link:" >&2
+    cat b.html >&2
+    exit 1
+fi
+grep -q Changed a.html
@@ -0,0 +1,66 @@
+// EditSession gives the tree a full parse of the edited text gives: random
+// edits to EML, HTML and XML documents, each checked node by node, ranges
+// included, against Parser::parse
+
+#include <iostream>
+#include <random>
+
+#include "session.h"
+#include "tree_shape.h"
+
+struct Kind {
+    const char* name;
+    bool eml;
+    bool html;
+    vector<string> pieces; // what documents are made of and edits insert
+};
+
+const Kind KINDS[] = {
+    {"eml", true, false,
+     {"div {", "}", " ", "\n", "span { a }", "p { text }", "li", "ul {", "b", "x",
+      "a (href=\"u\") {", "// c\n", "/* c */", "pre { raw } ", "br;", "{", "import x;"}},
+    {"html", false, true,
+     {"<div>", "</div>", "<p>", "</p>", "<ul>", "</ul>", "<li>", "</li>", "<table>", "</table>",
+      "<tr>", "<td>", "</td>", "<b>", "</b>", "<span>", "</span>", "<dl>", "<dt>", "<dd>",
+      "<br>", "text", " ", "\n", "<!-- c -->", "</x>", "<", ">", "/"}},
+    {"xml", false, false,
+     {"<a>", "</a>", "<b>", "</b>", "<c/>", "<d x=\"1\">", "</d>", "text", " ", "\n",
+      "<?pi?>", "<!-- c -->", "</x>", "<", ">"}},
+};
+
+int main() {
+    mt19937 rng(20261016);
+    auto pick = [&](size_t n) { return size_t(rng() % n); };
+    int failed = 0;
+    size_t edits = 0;
+
+    for (const Kind& kind : KINDS) {
+        for (int round = 0; round < 200 && failed < 5; ++round) {
+            string text;
+            for (size_t n = 5 + pick(40); n > 0; --n) text += kind.pieces[pick(kind.pieces.size())];
+            EditSession session(text, kind.eml, kind.html);
+
+            for (int step = 0; step < 30 && failed < 5; ++step, ++edits) {
+                size_t offset = pick(session.text().size() + 1);
+                size_t removed = pick(4) == 0 ? pick(8) : 0;
+                string inserted;
+                for (size_t n = pick(3); n > 0; --n) inserted += kind.pieces[pick(kind.pieces.size())];
+                string before(session.text());
+                session.edit(offset, removed, inserted);
+
+                Parser parser;
+                parser.html = kind.html;
+                Document full = parser.parse(string(session.text()), kind.eml);
+                string want = tree_shape(full.root, true);
+                string got = tree_shape(session.root(), true);
+                if (got != want) {
+                    cerr << kind.name << ": edit(" << offset << ", " << removed << ", \"" << inserted << "\") of\n"
+                         << before << "\n  full parse " << want << "\n  session    " << got << "\n";
+                    failed++;
+                }
+            }
+        }
+    }
+    if (failed == 0) cout << edits << " edits match a full parse\n";
+    return failed == 0 ? 0 : 1;
+}
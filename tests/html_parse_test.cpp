@@ -0,0 +1,56 @@
+// HTML markup parses with implied and stray end tags resolved against the
+// whole open-element stack (see implies_end_tag and bounds_implied_end)
+
+#include <iostream>
+
+#include "eml.h"
+#include "tree_shape.h"
+
+struct Case {
+    const char* html;
+    const char* shape; // of the root's children
+};
+
+const Case CASES[] = {
+    // A start tag ends the nearest open element it implies the end of
+    {"<ul><li>a<li>b</ul>", "ul(li('a') li('b'))"},
+    {"<table><tr><td>a<td>b<tr><td>c</table>", "table(tr(td('a') td('b')) tr(td('c')))"},
+    {"<p>a<div>b</div>", "p('a') div('b')"},
+    {"<dl><dt>a<dd>b<dt>c</dl>", "dl(dt('a') dd('b') dt('c'))"},
+    // ... also past open elements inside it
+    {"<table><tr><td><p>x<td>y</table>", "table(tr(td(p('x')) td('y')))"},
+    {"<ul><li><p>a<li>b</ul>", "ul(li(p('a')) li('b'))"},
+    {"<ul><li><span>a<li>b</ul>", "ul(li(span('a')) li('b'))"},
+    {"<p><b>a<div>b</div>", "p(b('a')) div('b')"},
+    // ... but not past a list, table or cell around the start tag
+    {"<ul><li>a<ul><li>b</ul><li>c</ul>", "ul(li('a' ul(li('b'))) li('c'))"},
+    {"<table><tr><td><table><tr><td>a<td>b</table>c</table>",
+     "table(tr(td(table(tr(td('a') td('b'))) 'c')))"},
+    {"<p>a<button><div>b</div></button>", "p('a' button(div('b')))"},
+    {"<li>a<dl><dt>b<li>c</dl>", "li('a' dl(dt('b' li('c'))))"},
+    // An end tag closes everything inside the element it names
+    {"<div><span>a</div>b", "div(span('a')) 'b'"},
+    // One that names no open element is dropped
+    {"<div>a</b>c</div>", "div('a' 'c')"},
+    {"</p>a", "'a'"},
+    {"<ul><li>a</li></p><li>b</li></ul>", "ul(li('a') li('b'))"},
+};
+
+int main() {
+    int failed = 0;
+    for (const Case& c : CASES) {
+        Parser parser;
+        parser.html = true;
+        Document doc = parser.parse(string(c.html), false);
+        string got;
+        for (size_t i = 0; i < doc.root->children.size(); ++i) {
+            if (i) got += ' ';
+            got += tree_shape(doc.root->children[i]);
+        }
+        if (got != c.shape) {
+            cerr << c.html << "\n  expected " << c.shape << "\n  got      " << got << "\n";
+            failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
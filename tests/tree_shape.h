@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+#include "eml.h"
+
+using namespace std;
+
+// A subtree on one line, for comparing trees in tests: elements as
+// tag(children), text quoted, other nodes by kind. With `ranges`, every node
+// also shows its [begin,end) in the source.
+inline string tree_shape(const Node* n, bool ranges = false) {
+    static const char* kinds[] = {"", "", "comment", "comment-block", "pi", "import", "ws"};
+    string s;
+    if (n->type == ELEMENT) s = string(n->tag.text());
+    else if (n->type == TEXT) s = "'" + string(n->content) + "'";
+    else s = kinds[n->type];
+    if (ranges) s += "[" + to_string(n->begin) + "," + to_string(n->end) + ")";
+    if (!n->children.empty()) {
+        s += "(";
+        for (size_t i = 0; i < n->children.size(); ++i) {
+            if (i) s += ' ';
+            s += tree_shape(n->children[i], ranges);
+        }
+        s += ")";
+    }
+    return s;
+}